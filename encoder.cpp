@@ -6,49 +6,140 @@
   ** Momentum functions removed. Reference Ashhar Farhan's original code to add it back **
 */
 
+#include <util/atomic.h>
 #include "ubitx.h"
 
+/* file-level constants */
+
+/*
+  the encoder phases are read straight from the port register in the ISR, so they
+  must stay on A0 (PC0) and A1 (PC1)
+*/
+static_assert(ENC_A == A0 && ENC_B == A1, "encoder ISR expects ENC_A on A0 and ENC_B on A1");
+static_assert(PTT == A3, "PTT sense in the encoder ISR expects PTT on A3");
+
+static constexpr uint8_t M_ENC_PIN_MASK = _BV(PINC0) | _BV(PINC1);
+static constexpr uint8_t M_PTT_PIN_MASK = _BV(PINC3);
+
+/* size of the detent event queue, must be a power of two */
+static constexpr uint8_t M_ENC_EVENT_QUEUE_SIZE = 16;
+static constexpr uint8_t M_ENC_EVENT_QUEUE_MASK = M_ENC_EVENT_QUEUE_SIZE - 1;
+
+/*
+  quadrature transition table, indexed by (previous state << 2) | current state
+  +1 is clockwise, -1 is counter-clockwise. A repeated state or a jump where both
+  phases changed at once (contact bounce, missed edge) is rejected with 0
+*/
+static const int8_t m_encoderTransitions[16] PROGMEM = {
+   0, +1, -1,  0,   // from 0
+  -1,  0,  0, +1,   // from 1
+  +1,  0,  0, -1,   // from 2
+   0, -1, +1,  0    // from 3
+};
+
 /* file-level variables */
 
 /* normal encoder state */
 static uint8_t m_previousEncoderState = 0;
-static int8_t m_encoderCount = 0;
+static volatile int16_t m_encoderCount = 0;  // net steps since the last encoderRead()
+static int8_t m_encoderDetentSteps = 0;      // steps since the last detent event, either way
+
+/*
+  single-producer / single-consumer detent event queue, one event per ENCODER_STEPS_PER_DETENT
+  steps so a fast spin doesn't fill it. The ISR is the only writer of the head and the main loop
+  is the only writer of the tail, so neither side has to wait on the other. If the queue fills
+  up during a long redraw, new events are dropped but the steps are still added to
+  m_encoderCount, so the net count is never lost
+*/
+static EncoderEvent m_encoderEvents[M_ENC_EVENT_QUEUE_SIZE];
+static volatile uint8_t m_encoderEventHead = 0;
+static volatile uint8_t m_encoderEventTail = 0;
+
+/* diagnostics - both counters stop at their maximum rather than wrap */
+static volatile uint16_t m_encoderRejected = 0;  // transitions where both phases changed at once
+static volatile uint16_t m_encoderDropped = 0;   // detents that found the event queue full
+
+/*
+  PTT shares the PCINT1 group with the encoder. The ISR latches the edges along with when the
+  press happened, so checkPTT() can time a press from the edge rather than from when loop()
+  got to it. A press that is already released by then is taken as a glitch and ignored
+*/
+static uint8_t m_previousPttState = M_PTT_PIN_MASK;
+static volatile uint8_t m_pttEdges = 0;
+static volatile uint32_t m_pttPressTime = 0;  // micros() of the first press edge since the last read
 
 /*
   returns a two-bit number such that each bit reflects the current
-  value of each of the two phases of the encoder
+  value of each of the two phases of the encoder (bit 0 is ENC_A, bit 1 is ENC_B)
 */
-uint8_t encoderState()
+static inline uint8_t encoderState ()
 {
-  return (digitalRead(ENC_A) ? 1 : 0) + (digitalRead(ENC_B) ? 2 : 0);
+  return PINC & M_ENC_PIN_MASK;
 }
 
 /*
   SmittyHalibut's encoder handling, using interrupts. Should be quicker, smoother handling.
   The Interrupt Service Routine for Pin Change Interrupts on A0-A5.
+
+  The port is read once and the previous / current state pair indexes the transition table,
+  so the ISR is a handful of cycles instead of two digitalRead() calls and a comparison chain
 */
 ISR (PCINT1_vect)
 {
-  uint8_t currentEncoderState = encoderState();
+  uint8_t pins = PINC;
+  uint8_t currentPttState = pins & M_PTT_PIN_MASK;
 
-  if (m_previousEncoderState == currentEncoderState)  // unnecessary ISR
-    return;
+  // PTT is active low, keep the time of the first press until checkPTT() collects it
+  if (currentPttState != m_previousPttState)
+  {
+    m_previousPttState = currentPttState;
 
-  // these transitions point to the encoder being rotated counter-clockwise
-  if ((m_previousEncoderState == 0 && currentEncoderState == 2) ||
-      (m_previousEncoderState == 2 && currentEncoderState == 3) ||
-      (m_previousEncoderState == 3 && currentEncoderState == 1) ||
-      (m_previousEncoderState == 1 && currentEncoderState == 0))
-    m_encoderCount -= 1;
+    if (!currentPttState)
+    {
+      if (!(m_pttEdges & PTT_PRESSED))
+        m_pttPressTime = micros();
 
-  // these transitions point to the encoder being rotated clockwise
-  else if ((m_previousEncoderState == 0 && currentEncoderState == 1) ||
-           (m_previousEncoderState == 1 && currentEncoderState == 3) ||
-           (m_previousEncoderState == 3 && currentEncoderState == 2) ||
-           (m_previousEncoderState == 2 && currentEncoderState == 0))
-    m_encoderCount += 1;
+      m_pttEdges |= PTT_PRESSED;
+    }
+    else
+      m_pttEdges |= PTT_RELEASED;
+  }
+
+  uint8_t currentEncoderState = pins & M_ENC_PIN_MASK;
+  uint8_t changed = m_previousEncoderState ^ currentEncoderState;
+  int8_t step = (int8_t)pgm_read_byte(&m_encoderTransitions[(m_previousEncoderState << 2) | currentEncoderState]);
 
   m_previousEncoderState = currentEncoderState;  // record state for next pulse interpretation
+
+  if (step == 0)  // unnecessary ISR or rejected bounce
+  {
+    if (changed == M_ENC_PIN_MASK && m_encoderRejected != 0xFFFF)
+      m_encoderRejected++;
+
+    return;
+  }
+
+  m_encoderCount += step;
+  m_encoderDetentSteps += step;
+
+  if (m_encoderDetentSteps != ENCODER_STEPS_PER_DETENT && m_encoderDetentSteps != -ENCODER_STEPS_PER_DETENT)
+    return;
+
+  step = (m_encoderDetentSteps > 0) ? 1 : -1;
+  m_encoderDetentSteps = 0;
+
+  // queue the detent and its time, unless the consumer is a full queue behind
+  uint8_t head = m_encoderEventHead;
+  uint8_t next = (head + 1) & M_ENC_EVENT_QUEUE_MASK;
+
+  if (next != m_encoderEventTail)
+  {
+    m_encoderEvents[head].time = micros();
+    m_encoderEvents[head].dir = step;
+    m_encoderEventHead = next;
+  }
+  else if (m_encoderDropped != 0xFFFF)
+    m_encoderDropped++;
 }
 
 /*
@@ -61,15 +152,22 @@ void pciSetup (uint8_t pin)
   PCICR |= bit (digitalPinToPCICRbit(pin));  // enable interrupt for the group
 }
 
-/* set up encoder */
+/* set up encoder and the PTT sense that shares its interrupt */
 void encoderSetup ()
 {
   m_encoderCount = 0;
+  m_encoderDetentSteps = 0;
+  m_encoderEventHead = 0;
+  m_encoderEventTail = 0;
   m_previousEncoderState = encoderState();
 
-  // setup Pin Change Interrupts for the encoder inputs
+  m_pttEdges = 0;
+  m_previousPttState = PINC & M_PTT_PIN_MASK;
+
+  // setup Pin Change Interrupts for the encoder and PTT inputs
   pciSetup(ENC_A);
   pciSetup(ENC_B);
+  pciSetup(PTT);
 }
 
 /*
@@ -77,13 +175,82 @@ void encoderSetup ()
 */
 int16_t encoderRead ()
 {
-  if (m_encoderCount != 0)
-  {
-    int16_t ret = m_encoderCount;
+  int16_t ret;
 
+  // the count is two bytes wide, so read and clear it with the ISR held off
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+  {
+    ret = m_encoderCount;
     m_encoderCount = 0;
-    return ret;
   }
 
-  return 0;
+  return ret;
+}
+
+/*
+  pops the oldest queued detent event into 'ev', returns false if there are none.
+  events carry the direction and micros() time of each detent so callers can work out
+  how fast the knob is turning. The net count is still taken with encoderRead()
+*/
+bool encoderReadEvent (EncoderEvent * ev)
+{
+  uint8_t tail = m_encoderEventTail;
+
+  if (tail == m_encoderEventHead)
+    return false;
+
+  *ev = m_encoderEvents[tail];
+  m_encoderEventTail = (tail + 1) & M_ENC_EVENT_QUEUE_MASK;
+
+  return true;
+}
+
+/* throws away any queued detent events, e.g. after a dialog that only used encoderRead() */
+void encoderFlushEvents ()
+{
+  m_encoderEventTail = m_encoderEventHead;
+}
+
+/*
+  encoder health counters: 'rejected' is the number of invalid transitions (both phases
+  changed between interrupts, so a step was missed or the contacts bounced) and 'dropped'
+  the number of detent events lost to a full queue. Pass 'reset' to start counting again
+*/
+void encoderStats (uint16_t * rejected, uint16_t * dropped, bool reset)
+{
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+  {
+    *rejected = m_encoderRejected;
+    *dropped = m_encoderDropped;
+
+    if (reset)
+    {
+      m_encoderRejected = 0;
+      m_encoderDropped = 0;
+    }
+  }
+}
+
+/*
+  returns the PTT_PRESSED / PTT_RELEASED edges latched since the last call and clears them.
+  if a press was latched, 'pressTime' gets the micros() time of it
+*/
+uint8_t pttReadEdges (uint32_t * pressTime)
+{
+  uint8_t edges;
+
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+  {
+    edges = m_pttEdges;
+    *pressTime = m_pttPressTime;
+    m_pttEdges = 0;
+  }
+
+  return edges;
+}
+
+/* true if the ISR has latched a PTT edge that checkPTT() hasn't handled yet */
+bool pttEdgePending ()
+{
+  return m_pttEdges != 0;
 }
@@ -4,6 +4,7 @@
   Detailed comments are available in the ubitx.h file
 */
 
+#include <util/atomic.h>
 #include "ubitx.h"
 
 /*
@@ -44,7 +45,11 @@ enum {
   KEYSTATE_CHK_DAH,
   KEYSTATE_KEYED_PREP,
   KEYSTATE_KEYED,
-  KEYSTATE_INTER_ELEMENT
+  KEYSTATE_INTER_ELEMENT,
+  KEYSTATE_SEND_NEXT,      // the states from here on play the memory element queue
+  KEYSTATE_SEND_PREP,
+  KEYSTATE_SEND_KEYED,
+  KEYSTATE_SEND_SPACE
 };
 
 /* variables for Ron's new logic */
@@ -52,238 +57,1156 @@ static constexpr uint8_t M_DIT_L = 0x01;  // DIT latch
 static constexpr uint8_t M_DAH_L = 0x02;  // DAH latch
 static constexpr uint8_t M_DIT_PROC = 0x04;  // DIT is being processed
 
-/* CW ADC Range */
-static constexpr uint8_t M_CW_ADC_ST_FROM = 0;
-static constexpr uint8_t M_CW_ADC_ST_TO = 50;
-static constexpr uint8_t M_CW_ADC_BOTH_FROM = 51;
-static constexpr uint16_t M_CW_ADC_BOTH_TO = 300;
-static constexpr uint16_t M_CW_ADC_DOT_FROM = 301;
-static constexpr uint16_t M_CW_ADC_DOT_TO = 600;
-static constexpr uint16_t M_CW_ADC_DASH_FROM = 601;
-static constexpr uint16_t M_CW_ADC_DASH_TO = 800;
+static constexpr uint8_t M_ST_L = 0x80;  // straight key level, only a DIT when not in iambic mode
+
+/*
+  CW ADC Range, classified by the top 6 bits of the reading (16 counts per entry)
+    0 - 47     straight key
+    48 - 303   dit and dah both pressed
+    304 - 607  dit
+    608 - 799  dah
+    800 - 1023 nothing pressed
+  (the old ranges were 0-50, 51-300, 301-600 and 601-800, each boundary moved to the nearest entry)
+*/
+static const uint8_t m_paddleClass[64] PROGMEM = {
+  M_ST_L, M_ST_L, M_ST_L,                                                       // 0 - 2
+  M_DIT_L | M_DAH_L, M_DIT_L | M_DAH_L, M_DIT_L | M_DAH_L, M_DIT_L | M_DAH_L,   // 3 - 6
+  M_DIT_L | M_DAH_L, M_DIT_L | M_DAH_L, M_DIT_L | M_DAH_L, M_DIT_L | M_DAH_L,   // 7 - 10
+  M_DIT_L | M_DAH_L, M_DIT_L | M_DAH_L, M_DIT_L | M_DAH_L, M_DIT_L | M_DAH_L,   // 11 - 14
+  M_DIT_L | M_DAH_L, M_DIT_L | M_DAH_L, M_DIT_L | M_DAH_L, M_DIT_L | M_DAH_L,   // 15 - 18
+  M_DIT_L, M_DIT_L, M_DIT_L, M_DIT_L, M_DIT_L, M_DIT_L, M_DIT_L, M_DIT_L,       // 19 - 26
+  M_DIT_L, M_DIT_L, M_DIT_L, M_DIT_L, M_DIT_L, M_DIT_L, M_DIT_L, M_DIT_L,       // 27 - 34
+  M_DIT_L, M_DIT_L, M_DIT_L,                                                    // 35 - 37
+  M_DAH_L, M_DAH_L, M_DAH_L, M_DAH_L, M_DAH_L, M_DAH_L,                         // 38 - 43
+  M_DAH_L, M_DAH_L, M_DAH_L, M_DAH_L, M_DAH_L, M_DAH_L,                         // 44 - 49
+  0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0                                      // 50 - 63
+};
+
+/* ANALOG_KEYER is A6, ADC channel 6. PTT (A3) is also read straight from the port */
+static_assert(ANALOG_KEYER == A6, "paddle ADC setup expects ANALOG_KEYER on A6");
+static constexpr uint8_t M_PADDLE_ADC_CHANNEL = 6;
+static constexpr uint8_t M_PTT_PIN_MASK = _BV(PINC3);
 
 static constexpr uint8_t M_DELAY_BEFORE_CW_START_TIME = 50;
 
+/*
+  the keyer state machine runs from the Timer1 compare interrupt, one tick every 250 us, so
+  element timing doesn't depend on how long loop() takes and each edge is within a quarter of a
+  millisecond. 16 MHz / 8 / 500 = 4 KHz
+*/
+static constexpr uint16_t M_KEYER_TICK_HZ = 4000;
+static constexpr uint16_t M_KEYER_TIMER_TOP = F_CPU / 8 / M_KEYER_TICK_HZ - 1;
+static constexpr uint8_t M_KEYER_TICKS_PER_MS = M_KEYER_TICK_HZ / 1000;
+
+/*
+  element lengths are kept in 1/256ths of a tick. Each tick takes a whole tick off and the part of
+  a tick an element overruns by is taken off the next one, so the average speed is exact even
+  though each edge lands on a tick
+*/
+static constexpr int32_t M_KEYER_TICK = 256;
+
+/*
+  sidetone. PIN_CW_TONE (D6) is OC0A, but Timer0 keeps millis(), so Timer2 drives the pin from its
+  compare interrupts : COMPA starts each cycle with the pin high and COMPB takes it low again.
+  The timer runs all the time at the sidetone frequency and the tone is gated by turning the
+  interrupts on and off. Over the first few cycles the high part grows to half the cycle and at
+  key up it shrinks away again, which takes the click off both ends
+*/
+static_assert(PIN_CW_TONE == 6, "sidetone driver expects PIN_CW_TONE on D6 (PD6)");
+static constexpr uint8_t M_SIDETONE_PIN_MASK = _BV(PORTD6);
+static constexpr uint8_t M_SIDETONE_RAMP_CYCLES = 4;  // 0 for a hard keyed sidetone that still stops on a whole cycle
+
+/*
+  decoder of the operator's own keying. The key interrupts queue the length of each mark and
+  space, cwKeyer() classifies them against a running dit estimate and builds up the character
+  in the same form as m_morseTable
+*/
+static constexpr uint8_t M_DECODE_QUEUE_SIZE = 16;  // must be a power of two
+static constexpr uint8_t M_DECODE_QUEUE_MASK = M_DECODE_QUEUE_SIZE - 1;
+static constexpr uint16_t M_DECODE_MARK = 0x8000;   // set on a mark, clear on a space, the rest is milliseconds
+static constexpr uint8_t M_DECODE_CHAR_GAP = 2;     // dits of space that end a character
+static constexpr uint8_t M_DECODE_WORD_GAP = 5;     // dits of space that end a word
+
+/* Timer2 prescalers, the clock select value is the index + 1 */
+static const uint16_t m_sidetonePrescale[7] PROGMEM = { 1, 8, 32, 64, 128, 256, 1024 };
+
+/*
+  Morse characters are one byte each : a leading 1 marks the start, then one bit per element from
+  the first to the last, 0 for a dit and 1 for a dah. e.g. 'A' (.-) is 0b101 and '?' (..--..) is 0b1001100
+*/
+static constexpr uint8_t morse (const char * pattern, uint8_t code = 1)
+{
+  return *pattern ? morse(pattern + 1, (code << 1) | (*pattern == '-' ? 1 : 0)) : code;
+}
+
+/* the table covers ',' to 'Z', 0 is a character with no Morse code */
+static constexpr char M_MORSE_FIRST = ',';
+static constexpr char M_MORSE_LAST = 'Z';
+
+static const uint8_t m_morseTable[M_MORSE_LAST - M_MORSE_FIRST + 1] PROGMEM = {
+  morse("--..--"), morse("-....-"), morse(".-.-.-"), morse("-..-."),                       // , - . /
+  morse("-----"), morse(".----"), morse("..---"), morse("...--"), morse("....-"),          // 0 - 4
+  morse("....."), morse("-...."), morse("--..."), morse("---.."), morse("----."),          // 5 - 9
+  morse("---..."), morse("-.-.-."), 0, morse("-...-"), 0, morse("..--.."), morse(".--.-."),  // : ; < = > ? @
+  morse(".-"), morse("-..."), morse("-.-."), morse("-.."), morse("."), morse("..-."),      // A - F
+  morse("--."), morse("...."), morse(".."), morse(".---"), morse("-.-"), morse(".-.."),   // G - L
+  morse("--"), morse("-."), morse("---"), morse(".--."), morse("--.-"), morse(".-."),     // M - R
+  morse("..."), morse("-"), morse("..-"), morse("...-"), morse(".--"), morse("-..-"),     // S - X
+  morse("-.--"), morse("--..")                                                           // Y - Z
+};
+
+/*
+  CW memories. '@' is replaced with the callsign and '#' with the contest serial number, which
+  goes up by one each time a message using it is sent in full. A message with a repeat time
+  is sent again that many seconds after it ends, until it is stopped
+*/
+struct CwMemory {
+  char name[6];        // shown when picking a memory
+  const char * text;   // PROGMEM
+  uint8_t repeat;      // seconds between repeats, 0 to send once
+};
+
+static const char m_cwMemoryCQ[] PROGMEM = "CQ CQ DE @ @ K";
+static const char m_cwMemoryExchange[] PROGMEM = "5NN #";
+static const char m_cwMemoryBeacon[] PROGMEM = "VVV DE @ BCN";
+
+static const CwMemory m_cwMemories[CW_MEMORIES] PROGMEM = {
+  {"CQ", m_cwMemoryCQ, 0},
+  {"Exch", m_cwMemoryExchange, 0},
+  {"Bcn", m_cwMemoryBeacon, 60}
+};
+
+/*
+  elements queued for the keyer interrupt. The gaps are on top of the one dit space that
+  follows every element, so a character gap is 3 dits and a word gap 7
+*/
+static constexpr uint8_t M_ELEMENT_DIT = 1;
+static constexpr uint8_t M_ELEMENT_DAH = 2;
+static constexpr uint8_t M_ELEMENT_CHAR_GAP = 3;  // 2 more dits
+static constexpr uint8_t M_ELEMENT_WORD_GAP = 4;  // 4 more dits
+
+/* size of the element queue, must be a power of two */
+static constexpr uint8_t M_SEND_QUEUE_SIZE = 32;
+static constexpr uint8_t M_SEND_QUEUE_MASK = M_SEND_QUEUE_SIZE - 1;
+static constexpr uint8_t M_SEND_CHAR_ELEMENTS = 7;  // room needed for the longest character and its gap
+
+static constexpr uint8_t M_NO_MEMORY = 0xFF;
+
+/* size of the keyboard CW type-ahead buffer, one slot is always left empty */
+static constexpr uint8_t M_TEXT_BUFFER_SIZE = CW_TEXT_BUFFER_SIZE + 1;
+static_assert((M_TEXT_BUFFER_SIZE & (M_TEXT_BUFFER_SIZE - 1)) == 0, "CW_TEXT_BUFFER_SIZE must be one less than a power of two");
+static constexpr uint8_t M_TEXT_BUFFER_MASK = M_TEXT_BUFFER_SIZE - 1;
+
 /* file-level variables */
-static uint32_t m_kTimer;
-static uint8_t m_keyerState = KEYSTATE_IDLE;
+static volatile uint8_t m_keyerState = KEYSTATE_IDLE;
+static int32_t m_kTimer = 0;                // time left in the current element or space, 1/256 ticks (ISR only)
+static uint8_t m_paddleLatch = 0;           // M_DIT_L, M_DAH_L and M_DIT_PROC bits (ISR only)
+static volatile bool m_txRequest = false;   // set by the ISR when it needs cwKeyer() to bring up TX
+static volatile uint16_t m_startDelay = 0;  // ticks to wait after TX comes up before the first key down
+static volatile uint8_t m_paddleState = 0;  // latest paddle classification, kept up to date by the ADC interrupt
+static volatile uint32_t m_keyerBusyTime = 0;  // millis() of the last tick that left the keyer busy, the CW delay counts from it
+
+/* element lengths in 1/256 ticks, worked out by cwTimingUpdate() when a setting changes */
+static uint32_t m_ditLength;
+static uint32_t m_dahLength;
+static uint32_t m_elementSpace;  // after every dit or dah
+static uint32_t m_charSpace;     // added to the element space at the end of a character
+static uint32_t m_wordSpace;     // added to the character space for a space
+
+/*
+  single-producer / single-consumer element queue. cwKeyer() spells the message into it and
+  the keyer interrupt plays it. Paddle input empties the queue and sets m_sendAborted
+*/
+static uint8_t m_sendQueue[M_SEND_QUEUE_SIZE];
+static volatile uint8_t m_sendHead = 0;
+static volatile uint8_t m_sendTail = 0;
+static volatile bool m_sendAborted = false;
+
+static uint8_t m_sendMemory = M_NO_MEMORY;  // memory being sent, or waiting to repeat
+static const char * m_sendText = NULL;      // next character of it to queue (PROGMEM), NULL when all queued
+static const char * m_sendMacro = NULL;     // rest of a macro being queued (RAM)
+static bool m_sendSerialUsed = false;       // the message used the serial number
+static uint32_t m_sendRepeatTime = 0;       // millis() when the memory is sent again, 0 if not waiting
+static uint16_t m_contestSerial = 1;
+static char m_contestSerialText[6];
+
+/* keyboard CW typed in over the serial port, spelled into the element queue a few characters ahead */
+static char m_textBuffer[M_TEXT_BUFFER_SIZE];
+static uint8_t m_textHead = 0;
+static uint8_t m_textTail = 0;
+
+static uint16_t m_decodeQueue[M_DECODE_QUEUE_SIZE];
+static volatile uint8_t m_decodeHead = 0;
+static volatile uint8_t m_decodeTail = 0;
+static volatile bool m_decodeKeyDown = false;
+static uint32_t m_decodeEdgeTime = 0;          // millis() of the last key edge (key interrupts only)
+static volatile uint32_t m_decodeUpTime = 0;   // millis() of the last key up
+static uint16_t m_decodeDit = 0;               // running dit estimate, milliseconds, 0 until the first mark
+static uint8_t m_decodeCode = 1;               // elements of the character so far, 1 for none, 0 if too long
+static bool m_decodeSpaceDue = false;          // a character was decoded and no space has followed it yet
+
+static uint8_t m_sidetoneHalf = 0;           // Timer2 counts in half a sidetone cycle
+static uint8_t m_sidetoneStep = 0;           // change in the high part of the cycle per cycle of ramp
+static volatile int8_t m_sidetoneRamp = 0;   // +1 ramping up, -1 ramping down to off, 0 steady
+
+/* a new sidetone cycle, steps the ramp and starts the high part */
+ISR (TIMER2_COMPA_vect)
+{
+  uint8_t duty = OCR2B;
+
+  if (m_sidetoneRamp > 0)
+  {
+    duty += m_sidetoneStep;
+
+    if (duty >= m_sidetoneHalf)
+    {
+      duty = m_sidetoneHalf;
+      m_sidetoneRamp = 0;
+    }
+  }
+  else if (m_sidetoneRamp < 0)
+  {
+    if (duty <= m_sidetoneStep)
+    {
+      // ramped down, the pin is already low
+      TIMSK2 = 0;
+      m_sidetoneRamp = 0;
+      return;
+    }
+
+    duty -= m_sidetoneStep;
+  }
+
+  OCR2B = duty;
+  PORTD |= M_SIDETONE_PIN_MASK;
+}
+
+/* end of the high part of a sidetone cycle */
+ISR (TIMER2_COMPB_vect)
+{
+  PORTD &= ~M_SIDETONE_PIN_MASK;
+}
+
+/*
+  starts the sidetone. From off, the first cycle starts straight away, otherwise the ramp turns
+  round from wherever it had got down to
+*/
+void sidetoneOn ()
+{
+  if (TIMSK2 == 0)
+  {
+    OCR2B = m_sidetoneStep;
+    TCNT2 = 0;
+    TIFR2 = _BV(OCF2A) | _BV(OCF2B);
+    PORTD |= M_SIDETONE_PIN_MASK;
+  }
+
+  m_sidetoneRamp = 1;
+  TIMSK2 = _BV(OCIE2A) | _BV(OCIE2B);
+}
+
+/* ramps the sidetone down, the COMPA interrupt turns it off at the end of the ramp */
+void sidetoneOff ()
+{
+  m_sidetoneRamp = -1;
+}
+
+/*
+  sets the Timer2 period for a sidetone of 'hz', with the smallest prescaler that fits the cycle
+  into 8 bits. Can be called while the sidetone is sounding
+*/
+void sidetoneTune (uint16_t hz)
+{
+  uint8_t prescale = 0;
+  uint32_t top = F_CPU / hz - 1;
+
+  while (top > 255 && prescale < 6)
+  {
+    prescale++;
+    top = F_CPU / pgm_read_word(&m_sidetonePrescale[prescale]) / hz - 1;
+  }
+
+  if (top > 255)
+    top = 255;
+
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+  {
+    m_sidetoneHalf = (top + 1) / 2;
+    m_sidetoneStep = m_sidetoneHalf / (M_SIDETONE_RAMP_CYCLES + 1);
+
+    if (m_sidetoneStep == 0)
+      m_sidetoneStep = 1;
+
+    if (OCR2B > m_sidetoneHalf)
+      OCR2B = m_sidetoneHalf;
+
+    TCCR2B = 0;
+    TCNT2 = 0;
+    OCR2A = top;
+    TCCR2B = prescale + 1;
+  }
+}
+
+/* queues the length of the mark or space a key edge has just ended, for the decoder */
+static void decodeEdge (bool down)
+{
+  if (down == m_decodeKeyDown)
+    return;
+
+  uint32_t now = millis();
+  uint32_t length = now - m_decodeEdgeTime;
+  uint8_t head = m_decodeHead;
+  uint8_t next = (head + 1) & M_DECODE_QUEUE_MASK;
+
+  m_decodeEdgeTime = now;
+  m_decodeKeyDown = down;
+
+  if (!down)
+    m_decodeUpTime = now;
+
+  // a full queue means loop() is stuck, the decoder will just get that character wrong
+  if (next == m_decodeTail)
+    return;
+
+  if (length > M_DECODE_MARK - 1)
+    length = M_DECODE_MARK - 1;
+
+  m_decodeQueue[head] = down ? length : (length | M_DECODE_MARK);
+  m_decodeHead = next;
+}
 
 /*
   starts transmitting the carrier with the sidetone
   it assumes that we have called cwTxStart and not called cwTxStop
-  each time it is called, the cwTimeOut is pushed further into the future
+  (called from the keyer interrupts, the Timer1 tick holds off the CW delay while keying)
 */
 void cwKeyDown ()
 {
-  tone(PIN_CW_TONE, (int16_t)g_sideTone);
+  sidetoneOn();
   digitalWrite(CW_KEY, 1);
 
-  // modified by KD8CEC, for CW Delay Time save to eeprom
-  g_cwTimeout = millis() + g_cwDelayTime * 10;
+  decodeEdge(true);
 }
 
 /*
   stops the cw carrier transmission along with the sidetone
-  pushes the cwTimeout further into the future
+  (called from the keyer interrupt)
 */
 void cwKeyUp ()
 {
-  noTone(PIN_CW_TONE);
+  sidetoneOff();
   digitalWrite(CW_KEY, 0);
 
-  // modified by KD8CEC, for CW Delay Time save to eeprom
-  g_cwTimeout = millis() + g_cwDelayTime * 10;
+  decodeEdge(false);
 }
 
 /*
   test to reduce the keying error. do not delete lines
   created by KD8CEC for compatible with new CW Logic
 */
-uint8_t updatePaddleLatch (bool isUpdateKeyState)
+static uint8_t updatePaddleLatch (bool isUpdateKeyState)
 {
-  uint8_t tmpKeyerControl = 0;  // was unsigned char
+  uint8_t tmpKeyerControl = m_paddleState;  // was unsigned char
 
-  uint16_t paddle = analogRead(ANALOG_KEYER);  // <<<--- changed from int because docs
-                                               //        say analogRead() returns 0 to 1024
-                                               //        *by default* for Arduino Nano
   // use the PTT as the key for tune up, quick QSOs
-  if (digitalRead(PTT) == 0)
-    tmpKeyerControl |= M_DIT_L;
-  else if (paddle >= M_CW_ADC_DASH_FROM && paddle <= M_CW_ADC_DASH_TO)
-    tmpKeyerControl |= M_DAH_L;
-  else if (paddle >= M_CW_ADC_DOT_FROM && paddle <= M_CW_ADC_DOT_TO)
-    tmpKeyerControl |= M_DIT_L;
-  else if (paddle >= M_CW_ADC_BOTH_FROM && paddle <= M_CW_ADC_BOTH_TO)
-    tmpKeyerControl |= (M_DAH_L | M_DIT_L) ;
-  else
+  if (!(PINC & M_PTT_PIN_MASK))
+    tmpKeyerControl = M_DIT_L;
+  else if (tmpKeyerControl == M_ST_L)
   {
     if (g_iambicKey)
       tmpKeyerControl = 0 ;
-    else if (paddle >= M_CW_ADC_ST_FROM && paddle <= M_CW_ADC_ST_TO)
-      tmpKeyerControl = M_DIT_L ;
     else
-      tmpKeyerControl = 0 ;
+      tmpKeyerControl = M_DIT_L ;
   }
 
   if (isUpdateKeyState)
-    g_keyerControl |= tmpKeyerControl;
+    m_paddleLatch |= tmpKeyerControl;
 
   return tmpKeyerControl;
 }
 
+/* takes one tick off the element being timed, returns true when it is over */
+static inline bool keyerTimerDone ()
+{
+  m_kTimer -= M_KEYER_TICK;
+
+  return m_kTimer <= 0;
+}
+
+/* starts timing an element or space of 'length' 1/256 ticks */
+static inline void keyerTime (uint32_t length)
+{
+  m_kTimer += length;
+}
+
+/*
+  holds the keyer in KEYSTATE_KEYED_PREP until TX is up. returns true when keying can start.
+  TX can't be started from the interrupt (it talks to the Si5351 over I2C), so cwKeyer() does it
+*/
+static bool keyerTxReady ()
+{
+  if (m_txRequest)
+    return false;
+
+  if (!g_inTx)
+  {
+    m_txRequest = true;
+    return false;
+  }
+
+  // DelayTime Option
+  if (m_startDelay > 0)
+  {
+    m_startDelay--;
+    return false;
+  }
+
+  return true;
+}
+
 /*
   new keyer logic, by RON
   modified by KD8CEC
+  one tick of the iambic keyer, runs as many state changes as it can without waiting
 */
-void cwKeyer ()
+static void iambicTick ()
 {
-  if (g_iambicKey)
+  while (true)
   {
-    bool continueKeyerLoop = true;
-    uint8_t tmpKeyControl = 0;
-
-    while (continueKeyerLoop)
+    switch (m_keyerState)
     {
-      switch (m_keyerState)
-      {
-        case KEYSTATE_IDLE:
-          tmpKeyControl = updatePaddleLatch(false);
-
-          if (tmpKeyControl == M_DAH_L || tmpKeyControl == M_DIT_L ||
-              tmpKeyControl == (M_DAH_L | M_DIT_L) || (g_keyerControl & 0x03))
-          {
-            updatePaddleLatch(true);
-            m_keyerState = KEYSTATE_CHK_DIT;
-          }
-          else
-          {
-            if (0 < g_cwTimeout && g_cwTimeout < millis())
-            {
-              g_cwTimeout = 0;
-              stopTx();
-            }
-
-            continueKeyerLoop = false;
-          }
-          break;
-
-        case KEYSTATE_CHK_DIT:
-          if (g_keyerControl & M_DIT_L)
-          {
-            g_keyerControl |= M_DIT_PROC;
-            m_kTimer = g_cwSpeed;
-            m_keyerState = KEYSTATE_KEYED_PREP;
-          }
-          else
-            m_keyerState = KEYSTATE_CHK_DAH;
-
-          break;
-
-        case KEYSTATE_CHK_DAH:
-          if (g_keyerControl & M_DAH_L)
-          {
-            m_kTimer = g_cwSpeed * 3;
-            m_keyerState = KEYSTATE_KEYED_PREP;
-          }
-          else
-            m_keyerState = KEYSTATE_IDLE;
-
-          break;
-
-        case KEYSTATE_KEYED_PREP:
-          // modified KD8CEC
-          if (!g_inTx)
-          {
-            // DelayTime Option
-            activeDelay(M_DELAY_BEFORE_CW_START_TIME * 2);
-
-            // keyDown = 0;
-            g_cwTimeout = millis() + g_cwDelayTime * 10;
-            startTx(TX_CW);
-          }
-
-          m_kTimer += millis();  // set m_kTimer to interval end time
-          g_keyerControl &= ~(M_DIT_L + M_DAH_L);  // clear both paddle latch bits
-          m_keyerState = KEYSTATE_KEYED;  // next state
-
-          cwKeyDown();
-          break;
-
-        case KEYSTATE_KEYED:
-          if (millis() > m_kTimer)
-          { // are we at end of key down ?
-            cwKeyUp();
-            m_kTimer = millis() + g_cwSpeed;  // inter-element time
-            m_keyerState = KEYSTATE_INTER_ELEMENT;  // next state
-          }
-          else
-          if (g_keyerControl & IAMBICB)
-            updatePaddleLatch(true);  // early paddle latch in Iambic B mode
-
-          break;
-
-        case KEYSTATE_INTER_ELEMENT:
-          // insert time between dits/dahs
-          updatePaddleLatch(true);  // latch paddle state
-
-          if (millis() > m_kTimer)
-          { // are we at end of inter-space ?
-            if (g_keyerControl & M_DIT_PROC)
-            { // was it a dit or dah ?
-              g_keyerControl &= ~(M_DIT_L + M_DIT_PROC);  // clear two bits
-              m_keyerState = KEYSTATE_CHK_DAH;  // dit done, check for dah
-            }
-            else
-            {
-              g_keyerControl &= ~(M_DAH_L);  // clear dah latch
-              m_keyerState = KEYSTATE_IDLE;  // go idle
-            }
-          }
-          break;
-      }
+      case KEYSTATE_IDLE:
+        if (updatePaddleLatch(false) != 0 || (m_paddleLatch & (M_DIT_L | M_DAH_L)))
+        {
+          updatePaddleLatch(true);
+          m_keyerState = KEYSTATE_CHK_DIT;
+        }
+        else
+          return;
+
+        break;
 
-      checkCAT();
-    }  // end of while
+      case KEYSTATE_CHK_DIT:
+        if (m_paddleLatch & M_DIT_L)
+        {
+          m_paddleLatch |= M_DIT_PROC;
+          keyerTime(m_ditLength);
+          m_keyerState = KEYSTATE_KEYED_PREP;
+        }
+        else
+          m_keyerState = KEYSTATE_CHK_DAH;
+
+        break;
+
+      case KEYSTATE_CHK_DAH:
+        if (m_paddleLatch & M_DAH_L)
+        {
+          keyerTime(m_dahLength);
+          m_keyerState = KEYSTATE_KEYED_PREP;
+        }
+        else
+          m_keyerState = KEYSTATE_IDLE;
+
+        break;
+
+      case KEYSTATE_KEYED_PREP:
+        if (!keyerTxReady())
+          return;
+
+        m_paddleLatch &= ~(M_DIT_L + M_DAH_L);  // clear both paddle latch bits
+        m_keyerState = KEYSTATE_KEYED;  // next state
+
+        cwKeyDown();
+        return;
+
+      case KEYSTATE_KEYED:
+        if (keyerTimerDone())
+        { // are we at end of key down ?
+          cwKeyUp();
+          keyerTime(m_elementSpace);  // inter-element time
+          m_keyerState = KEYSTATE_INTER_ELEMENT;  // next state
+        }
+        else
+        if (g_keyerControl & IAMBICB)
+          updatePaddleLatch(true);  // early paddle latch in Iambic B mode
+
+        return;
+
+      case KEYSTATE_INTER_ELEMENT:
+        // insert time between dits/dahs
+        updatePaddleLatch(true);  // latch paddle state
+
+        if (!keyerTimerDone())
+          return;
+
+        // we are at end of inter-space
+        if (m_paddleLatch & M_DIT_PROC)
+        { // was it a dit or dah ?
+          m_paddleLatch &= ~(M_DIT_L + M_DIT_PROC);  // clear two bits
+          m_keyerState = KEYSTATE_CHK_DAH;  // dit done, check for dah
+        }
+        else
+        {
+          m_paddleLatch &= ~(M_DAH_L);  // clear dah latch
+          m_keyerState = KEYSTATE_IDLE;  // go idle
+        }
+        break;
+    }
   }
-  else
+}
+
+/*
+  one tick of memory playback, takes the next element off the queue when the last one is done.
+  returns to KEYSTATE_IDLE when the queue runs dry
+*/
+static void sendTick ()
+{
+  while (true)
   {
-    while (true)
+    switch (m_keyerState)
     {
-      uint8_t state = updatePaddleLatch(false);
+      case KEYSTATE_SEND_PREP:
+        if (!keyerTxReady())
+          return;
 
-      if (state == M_DIT_L)
+        m_keyerState = KEYSTATE_SEND_KEYED;
+
+        cwKeyDown();
+        return;
+
+      case KEYSTATE_SEND_KEYED:
+        if (!keyerTimerDone())
+          return;
+
+        cwKeyUp();
+        keyerTime(m_elementSpace);  // inter-element time
+        m_keyerState = KEYSTATE_SEND_SPACE;
+        return;
+
+      case KEYSTATE_SEND_SPACE:
+        if (!keyerTimerDone())
+          return;
+
+        m_keyerState = KEYSTATE_SEND_NEXT;
+        break;
+
+      default:
       {
-        // if we are here, it is only because the key is pressed
-        if (!g_inTx)
+        uint8_t tail = m_sendTail;
+
+        if (tail == m_sendHead)
         {
-          startTx(TX_CW);
+          m_keyerState = KEYSTATE_IDLE;
+          return;
+        }
 
-          // delayTime Option
-          activeDelay(M_DELAY_BEFORE_CW_START_TIME * 2);
+        uint8_t element = m_sendQueue[tail];
+        m_sendTail = (tail + 1) & M_SEND_QUEUE_MASK;
 
-          // keyDown = 0;
-          g_cwTimeout = millis() + g_cwDelayTime * 10;
+        if (element == M_ELEMENT_DIT)
+        {
+          keyerTime(m_ditLength);
+          m_keyerState = KEYSTATE_SEND_PREP;
+        }
+        else if (element == M_ELEMENT_DAH)
+        {
+          keyerTime(m_dahLength);
+          m_keyerState = KEYSTATE_SEND_PREP;
         }
+        else
+        {
+          m_kTimer += (element == M_ELEMENT_CHAR_GAP ? m_charSpace : m_wordSpace);
+          m_keyerState = KEYSTATE_SEND_SPACE;
+          return;
+        }
+        break;
+      }
+    }
+  }
+}
 
-        cwKeyDown();
+/* drops the rest of the memory being played, key up if needed (interrupts must be off) */
+static void sendFlush ()
+{
+  if (m_keyerState == KEYSTATE_SEND_KEYED)
+    cwKeyUp();
 
-        while (updatePaddleLatch(false) == M_DIT_L)
-          activeDelay(1);
+  if (m_keyerState >= KEYSTATE_SEND_NEXT)
+  {
+    m_keyerState = KEYSTATE_IDLE;
+    m_kTimer = 0;
+  }
 
-        cwKeyUp();
+  if (m_sendTail != m_sendHead)
+    m_sendAborted = true;
+
+  m_sendTail = m_sendHead;
+}
+
+/*
+  straight key edges, called after every paddle conversion (about every 104 us). Once TX is up
+  the key is mirrored to CW_KEY and the sidetone here, the keyer tick only has to get TX going
+*/
+static void handKeyFollow ()
+{
+  bool keyDown = (updatePaddleLatch(false) == M_DIT_L);
+
+  if (m_keyerState == KEYSTATE_KEYED && !keyDown)
+  {
+    cwKeyUp();
+    m_keyerState = KEYSTATE_IDLE;
+  }
+  else if (m_keyerState == KEYSTATE_IDLE && keyDown && g_inTx && !m_txRequest && m_startDelay == 0)
+  {
+    cwKeyDown();
+    m_keyerState = KEYSTATE_KEYED;
+  }
+}
+
+/* one tick of the straight key, brings up TX for a key down that handKeyFollow() can't key yet */
+static void handKeyTick ()
+{
+  bool keyDown = (updatePaddleLatch(false) == M_DIT_L);
+
+  switch (m_keyerState)
+  {
+    case KEYSTATE_IDLE:
+      if (!keyDown)
+        break;
+
+      m_keyerState = KEYSTATE_KEYED_PREP;
+
+      // fall through
+    case KEYSTATE_KEYED_PREP:
+      if (!keyDown)
+        m_keyerState = KEYSTATE_IDLE;  // let go before TX was up
+      else if (keyerTxReady())
+      {
+        cwKeyDown();
+        m_keyerState = KEYSTATE_KEYED;
       }
-      else
+      break;
+
+    default:
+      if (!keyDown)
       {
-        if (0 < g_cwTimeout && g_cwTimeout < millis())
-        {
-          g_cwTimeout = 0;
-          stopTx();
-        }
+        cwKeyUp();
+        m_keyerState = KEYSTATE_IDLE;
+      }
+      break;
+  }
+}
+
+/*
+  the ADC free-runs on the paddle input and each finished conversion is classified here,
+  so reading the paddle is a single byte load instead of a 110 us analogRead()
+*/
+ISR (ADC_vect)
+{
+  m_paddleState = pgm_read_byte(&m_paddleClass[ADCH >> 2]);  // left adjusted, top 6 of 10 bits
+
+  // a straight key is followed at the conversion rate rather than the keyer tick
+  if (g_cwMode && !g_iambicKey)
+    handKeyFollow();
+}
+
+/* one tick of whichever of the memory, the iambic keyer or the straight key is in charge */
+static void keyerTick ()
+{
+  // a memory plays while the paddle is left alone, touching it stops the memory
+  if (m_keyerState >= KEYSTATE_SEND_NEXT || m_sendTail != m_sendHead)
+  {
+    if (updatePaddleLatch(false) == 0 && (m_keyerState == KEYSTATE_IDLE || m_keyerState >= KEYSTATE_SEND_NEXT))
+    {
+      sendTick();
+      return;
+    }
+
+    sendFlush();
+    m_sendAborted = true;
+  }
+
+  if (g_iambicKey)
+    iambicTick();
+  else
+    handKeyTick();
+}
+
+/* keyer timer tick */
+ISR (TIMER1_COMPA_vect)
+{
+  if (!g_cwMode)
+  {
+    // CW was switched off in the middle of a character
+    if (m_keyerState != KEYSTATE_IDLE)
+    {
+      cwKeyUp();
+      m_keyerState = KEYSTATE_IDLE;
+      m_kTimer = 0;
+      m_paddleLatch = 0;
+      m_txRequest = false;
+    }
+
+    sendFlush();
+    return;
+  }
+
+  keyerTick();
+
+  // stamped here rather than by cwKeyer(), so a slow loop() can't move the end of the CW delay
+  if (m_keyerState != KEYSTATE_IDLE)
+    m_keyerBusyTime = millis();
+}
+
+/*
+  works out the element lengths from g_cwWpm, g_cwWeight, g_cwDahRatio, g_cwSpaceRatio and
+  g_cwFarnsworth, so the keyer interrupt only has to add them up. A dit is 1200 / wpm ms (PARIS).
+  The weight is a dit's share of itself and the space after it, 50% standard, so each point
+  over 50 takes 2% of a dit from the space after every element and adds it to the element.
+  g_cwSpaceRatio sets the space between the elements of a character on its own, the character
+  and word gaps stay 3 and 7 dits. With Farnsworth spacing the characters are sent at g_cwWpm
+  and the gaps between them are stretched to bring the overall speed down to g_cwFarnsworth
+  (the ARRL formula)
+*/
+void cwTimingUpdate ()
+{
+  uint32_t dit = (1200UL * M_KEYER_TICK * M_KEYER_TICKS_PER_MS) / g_cwWpm;
+  int32_t weight = ((int32_t)dit * ((int16_t)g_cwWeight - 50)) / 50;
+  uint32_t space = (dit * g_cwSpaceRatio) / 10;
+
+  uint32_t ditLength = dit + weight;
+  uint32_t dahLength = (dit * g_cwDahRatio) / 10 + weight;
+  int32_t elementSpace = (int32_t)space - weight;
+
+  // a heavy weight on a short space would leave next to no gap, keep a quarter of a dit
+  if (elementSpace < (int32_t)(dit / 4))
+    elementSpace = dit / 4;
+
+  // total character and word gaps, counted from the end of the last element
+  uint32_t charGap = dit * 3;
+  uint32_t wordGap = dit * 7;
+
+  if (g_cwFarnsworth != 0 && g_cwFarnsworth < g_cwWpm)
+  {
+    uint32_t c = g_cwWpm;
+    uint32_t s = g_cwFarnsworth;
+    uint32_t delay = ((60000UL * c - 37200UL * s) * M_KEYER_TICK) / (s * c) * M_KEYER_TICKS_PER_MS;  // ta, in 1/256 ticks
+
+    charGap = (delay * 3) / 19;
+    wordGap = (delay * 7) / 19;
+  }
+
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+  {
+    m_ditLength = ditLength;
+    m_dahLength = dahLength;
+    m_elementSpace = elementSpace;
+    m_charSpace = charGap - space;
+    m_wordSpace = wordGap - charGap;
+  }
+}
+
+/* starts the paddle ADC and the keyer timer interrupt */
+void keyerSetup ()
+{
+  cwTimingUpdate();
+
+  // sidetone timer, CTC mode with the interrupts off until key down
+  TIMSK2 = 0;
+  TCCR2A = _BV(WGM21);
+  sidetoneTune(g_sideTone);
+
+  // AVcc reference, left adjusted result, paddle channel
+  ADMUX = _BV(REFS0) | _BV(ADLAR) | M_PADDLE_ADC_CHANNEL;
+  ADCSRB = 0;  // free running
+  ADCSRA = _BV(ADEN) | _BV(ADSC) | _BV(ADATE) | _BV(ADIE) | _BV(ADPS2) | _BV(ADPS1) | _BV(ADPS0);  // clock / 128
+
+
+  TCCR1A = 0;
+  TCCR1B = _BV(WGM12) | _BV(CS11);  // CTC mode, clock / 8
+  OCR1A = M_KEYER_TIMER_TOP;
+  TIMSK1 |= _BV(OCIE1A);
+}
+
+/* next character of the memory being queued, with the macros expanded. 0 at the end */
+static char sendNextChar ()
+{
+  while (true)
+  {
+    if (m_sendMacro != NULL)
+    {
+      char c = *m_sendMacro++;
+
+      if (c != 0)
+        return c;
+
+      m_sendMacro = NULL;
+    }
+
+    char c = pgm_read_byte(m_sendText++);
+
+    if (c == '@')
+      m_sendMacro = g_cwCallsign;
+    else if (c == '#')
+    {
+      // three digits at least, 001 rather than 1
+      char * digits = m_contestSerialText;
+
+      if (m_contestSerial < 100)
+        *digits++ = '0';
+      if (m_contestSerial < 10)
+        *digits++ = '0';
+
+      utoa(m_contestSerial, digits, 10);
+
+      m_sendMacro = m_contestSerialText;
+      m_sendSerialUsed = true;
+    }
+    else
+      return c;
+  }
+}
+
+/* adds an element to the queue, the caller has checked there is room */
+static void sendQueueElement (uint8_t element)
+{
+  uint8_t head = m_sendHead;
+
+  m_sendQueue[head] = element;
+  m_sendHead = (head + 1) & M_SEND_QUEUE_MASK;
+}
+
+/* spells one character into the element queue, characters with no Morse code are skipped */
+static void sendQueueChar (char c)
+{
+  if (c == ' ')
+  {
+    sendQueueElement(M_ELEMENT_WORD_GAP);
+    return;
+  }
+
+  c = toupper(c);
+
+  if (c < M_MORSE_FIRST || c > M_MORSE_LAST)
+    return;
+
+  uint8_t code = pgm_read_byte(&m_morseTable[c - M_MORSE_FIRST]);
+
+  if (code == 0)
+    return;
+
+  // skip down to the start marker, the elements are the bits below it
+  uint8_t mask = 0x80;
+
+  while (!(code & mask))
+    mask >>= 1;
+
+  while (mask >>= 1)
+    sendQueueElement((code & mask) ? M_ELEMENT_DAH : M_ELEMENT_DIT);
+
+  sendQueueElement(M_ELEMENT_CHAR_GAP);
+}
+
+/* true if the element queue has room for one more character */
+static inline bool sendQueueRoom ()
+{
+  return ((m_sendTail - m_sendHead - 1) & M_SEND_QUEUE_MASK) >= M_SEND_CHAR_ELEMENTS;
+}
+
+/*
+  keeps the element queue topped up from the memory being sent, and starts it again when it
+  is due to repeat. Typed text is queued when no memory is active. Called from cwKeyer(),
+  only a few characters are queued ahead of the keyer
+*/
+static void sendMemory ()
+{
+  // the operator took over with the paddle, drop the rest of the memory and the typed text
+  if (m_sendAborted)
+  {
+    cwMemoryStop();
+    m_textTail = m_textHead;
+    return;
+  }
+
+  if (m_sendMemory == M_NO_MEMORY)
+  {
+    while (m_textTail != m_textHead && sendQueueRoom())
+    {
+      sendQueueChar(m_textBuffer[m_textTail]);
+      m_textTail = (m_textTail + 1) & M_TEXT_BUFFER_MASK;
+    }
+
+    return;
+  }
+
+  if (m_sendRepeatTime != 0)
+  {
+    if ((int32_t)(millis() - m_sendRepeatTime) < 0)
+      return;
+
+    m_sendRepeatTime = 0;
+    m_sendText = (const char *)pgm_read_word(&m_cwMemories[m_sendMemory].text);
+  }
+
+  while (m_sendText != NULL && sendQueueRoom())
+  {
+    char c = sendNextChar();
+
+    if (c == 0)
+      m_sendText = NULL;
+    else
+      sendQueueChar(c);
+  }
+
+  // still sending ?
+  if (m_sendText != NULL || m_sendTail != m_sendHead || m_keyerState >= KEYSTATE_SEND_NEXT)
+    return;
+
+  if (m_sendSerialUsed)
+  {
+    m_contestSerial++;
+    m_sendSerialUsed = false;
+  }
+
+  uint8_t repeat = pgm_read_byte(&m_cwMemories[m_sendMemory].repeat);
 
-        return;  // Tx stop control by Main Loop
+  if (repeat != 0)
+    m_sendRepeatTime = (millis() + repeat * 1000UL) | 1;  // never 0
+  else
+    m_sendMemory = M_NO_MEMORY;
+}
+
+/*
+  forgets paddle input the keyer interrupt latched while a dialog had the screen, so closing it
+  doesn't send a stray element. An element waiting for TX is dropped, one already being sent
+  finishes, and a memory carries on
+*/
+void cwKeyerCancel ()
+{
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+  {
+    m_paddleLatch = 0;
+
+    if (m_keyerState == KEYSTATE_CHK_DIT || m_keyerState == KEYSTATE_CHK_DAH || m_keyerState == KEYSTATE_KEYED_PREP)
+    {
+      m_keyerState = KEYSTATE_IDLE;
+      m_kTimer = 0;
+      m_txRequest = false;
+    }
+  }
+}
+
+/* starts sending a CW memory through the keyer, stopping any memory already being sent */
+void cwMemoryStart (uint8_t memory)
+{
+  if (memory >= CW_MEMORIES)
+    return;
+
+  cwMemoryStop();
+
+  m_sendMemory = memory;
+  m_sendText = (const char *)pgm_read_word(&m_cwMemories[memory].text);
+}
+
+/* stops the memory being sent, or a beacon waiting to repeat */
+void cwMemoryStop ()
+{
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+  {
+    sendFlush();
+    m_sendAborted = false;
+  }
+
+  m_sendMemory = M_NO_MEMORY;
+  m_sendText = NULL;
+  m_sendMacro = NULL;
+  m_sendSerialUsed = false;
+  m_sendRepeatTime = 0;
+}
+
+/* true while a memory is being sent or is waiting to repeat */
+bool cwMemoryBusy ()
+{
+  return m_sendMemory != M_NO_MEMORY;
+}
+
+/* copies the name of a CW memory into 'buffOut' */
+void cwMemoryName (uint8_t memory, char * buffOut)
+{
+  memcpy_P(buffOut, m_cwMemories[memory].name, sizeof(m_cwMemories[memory].name));
+}
+
+/*
+  adds a typed character to the keyboard CW buffer, returns false if it is full. Backspace takes
+  back the last character if it hasn't been spelled into the element queue yet
+*/
+bool cwTextPut (char c)
+{
+  if (c == '\b')
+  {
+    if (m_textHead != m_textTail)
+      m_textHead = (m_textHead - 1) & M_TEXT_BUFFER_MASK;
+
+    return true;
+  }
+
+  if (c == '\r' || c == '\n')
+    c = ' ';
+
+  uint8_t next = (m_textHead + 1) & M_TEXT_BUFFER_MASK;
+
+  if (next == m_textTail)
+    return false;
+
+  m_textBuffer[m_textHead] = c;
+  m_textHead = next;
+
+  return true;
+}
+
+/* room left in the keyboard CW buffer */
+uint8_t cwTextFree ()
+{
+  return (m_textTail - m_textHead - 1) & M_TEXT_BUFFER_MASK;
+}
+
+/* shows the character decoded from 'code' (0 or not in the table is shown as '*') */
+static void decodeShow (uint8_t code)
+{
+  char c = '*';
+
+  for (uint8_t i = 0; code != 0 && i < sizeof(m_morseTable); i++)
+  {
+    if (pgm_read_byte(&m_morseTable[i]) == code)
+    {
+      c = M_MORSE_FIRST + i;
+      break;
+    }
+  }
+
+  drawDecodedChar(c);
+
+  m_decodeSpaceDue = true;
+}
+
+/* a space of 'length' ms has gone by since the last mark, ends the character or the word */
+static void decodeSpace (uint16_t length)
+{
+  if (m_decodeCode != 1 && length >= m_decodeDit * M_DECODE_CHAR_GAP)
+  {
+    decodeShow(m_decodeCode);
+    m_decodeCode = 1;
+  }
+
+  if (m_decodeSpaceDue && length >= m_decodeDit * M_DECODE_WORD_GAP)
+  {
+    drawDecodedChar(' ');
+    m_decodeSpaceDue = false;
+  }
+}
+
+/*
+  decodes the queued key edges, a fixed amount of work for each. A mark under two dits long is a
+  dit. The dit estimate follows the operator, a quarter of the way towards each new dit (or a
+  third of each new dah)
+*/
+static void decodeKeying ()
+{
+  if (m_decodeDit == 0)
+    m_decodeDit = 1200 / g_cwWpm;
+
+  while (m_decodeTail != m_decodeHead)
+  {
+    uint8_t tail = m_decodeTail;
+    uint16_t event = m_decodeQueue[tail];
+    uint16_t length = event & ~M_DECODE_MARK;
+
+    m_decodeTail = (tail + 1) & M_DECODE_QUEUE_MASK;
+
+    if (!(event & M_DECODE_MARK))
+    {
+      decodeSpace(length);
+      continue;
+    }
+
+    bool dah = (length >= m_decodeDit * 2);
+
+    m_decodeDit = (m_decodeDit * 3 + (dah ? length / 3 : length)) / 4;
+
+    if (m_decodeDit == 0)
+      m_decodeDit = 1;
+
+    // more than six elements doesn't fit, it will show as '*'
+    if (m_decodeCode & 0x40)
+      m_decodeCode = 0;
+    else if (m_decodeCode != 0)
+      m_decodeCode = (m_decodeCode << 1) | (dah ? 1 : 0);
+  }
+
+  // the key is still up, so the space so far might already end the character or the word
+  if (!m_decodeKeyDown)
+  {
+    uint32_t upTime;
+
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+      upTime = m_decodeUpTime;
+    }
+
+    uint32_t length = millis() - upTime;
+
+    decodeSpace(length > 0xFFFF ? 0xFFFF : length);
+  }
+}
+
+/*
+  called from loop() in CW mode. The keying itself happens in the timer interrupt, this only
+  does the T/R switching the interrupt can't do : it brings up TX when the keyer asks for it
+  and drops back to RX once the keyer has been idle for the CW delay time. The delay runs from
+  the last keyer tick that was busy, however late loop() gets here
+*/
+void cwKeyer ()
+{
+  sendMemory();
+  decodeKeying();
+
+  if (m_txRequest)
+  {
+    if (!g_inTx)
+    {
+      startTx(TX_CW);
+
+      // the interrupts leave it alone until m_txRequest is cleared
+      m_startDelay = M_DELAY_BEFORE_CW_START_TIME * 2 * M_KEYER_TICKS_PER_MS;
+    }
+
+    g_cwTimeout = millis() + g_cwDelayTime * 10;
+    m_txRequest = false;
+  }
+
+  // modified by KD8CEC, for CW Delay Time save to eeprom
+  uint32_t now = millis();
+  bool release = false;
+
+  // TX is marked down in the same breath as the idle check, so the keyer interrupt can't key
+  // while stopTx() drops it. A key down from here on asks for TX again instead
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+  {
+    if (g_cwTimeout > 0)
+    {
+      g_cwTimeout = m_keyerBusyTime + g_cwDelayTime * 10;
+
+      if (m_keyerState == KEYSTATE_IDLE && g_cwTimeout < now)
+      {
+        g_inTx = false;
+        release = true;
       }
+    }
+  }
 
-      checkCAT();
-    }  // end of while
-  }   // end of else
+  if (release)
+  {
+    g_cwTimeout = 0;
+    stopTx();
+  }
 }
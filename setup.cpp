@@ -28,6 +28,10 @@
 /* these are used by the si5351 routines in the ubitx_5351 file */
 extern int32_t g_calibration;
 
+/* file-level constants */
+static constexpr uint8_t M_MENU_ITEMS = 7;         // number of setup menu lines, including 'Exit'
+static constexpr uint8_t M_MENU_ITEM_HEIGHT = 25;  // vertical spacing of the setup menu lines
+
 /* file-level variables */
 static int16_t m_prevPuck = -1;
 
@@ -176,7 +180,105 @@ static void setupCwDelay ()
   g_menuOn = false;
 }
 
-/* set up keyer type */
+/* shows a keyer timing value for setupKeyerValue(), 'tenths' shows 30 as 3.0 */
+static void drawKeyerValue (uint8_t value, bool tenths, const char * postfix)
+{
+  if (value == 0)
+    strcpy(g_buffB, "< Off >");
+  else
+  {
+    strcpy(g_buffB, "< ");
+    itoa(tenths ? value / 10 : value, g_buffC, 10);
+    strcat(g_buffB, g_buffC);
+
+    if (tenths)
+    {
+      strcat(g_buffB, ".");
+      itoa(value % 10, g_buffC, 10);
+      strcat(g_buffB, g_buffC);
+    }
+
+    strcat(g_buffB, postfix);
+    strcat(g_buffB, " >");
+  }
+
+  drawTextWithRectFilled(g_buffB, 60, 110, 195, 35, G_DISPLAY_WHITE, G_DISPLAY_NEWBACK, G_DISPLAY_CYAN);
+}
+
+/*
+  one page of the keyer timing setup, returns the value chosen with the knob. If 'canBeOff' is set,
+  turning down past the minimum gives 0, shown as 'Off'
+*/
+static uint8_t setupKeyerValue (const char * title, uint8_t value, uint8_t minimum, uint8_t maximum, bool tenths,
+    const char * postfix, bool canBeOff)
+{
+  int16_t knob;
+
+  displayDialog(title, "Press tune to Save");
+
+  drawKeyerValue(value, tenths, postfix);
+
+  // the previous page was left with the button
+  while (encoderButtonDown())
+    activeDelay(50);
+
+  // loop until the encoder button is pushed
+  while (!encoderButtonDown())
+  {
+    knob = encoderRead();
+
+    if (knob == 0)
+    {
+      activeDelay(50);
+      continue;
+    }
+
+    if (knob < 0 && value > minimum)
+      value--;
+    else if (knob < 0 && value == minimum && canBeOff)
+      value = 0;
+    else if (knob > 0 && value == 0 && canBeOff)
+      value = minimum;
+    else if (knob > 0 && value < maximum)
+      value++;
+    else
+      continue;
+
+    drawKeyerValue(value, tenths, postfix);
+  }
+
+  activeDelay(500);
+
+  return value;
+}
+
+/*
+  keyer timing, after the keyer type : the weight, the dah length, the space between elements
+  and Farnsworth spacing (which can only be slower than the character speed)
+*/
+static void setupKeyerTiming ()
+{
+  g_cwWeight = setupKeyerValue("Set CW Weight", g_cwWeight, CW_WEIGHT_MIN, CW_WEIGHT_MAX, false, "", false);
+  EEPROM.put(CW_WEIGHT, g_cwWeight);
+
+  g_cwDahRatio = setupKeyerValue("Set Dah Length", g_cwDahRatio, CW_DAH_RATIO_MIN, CW_DAH_RATIO_MAX, true, " dits",
+    false);
+  EEPROM.put(CW_DAH_RATIO, g_cwDahRatio);
+
+  g_cwSpaceRatio = setupKeyerValue("Set Element Gap", g_cwSpaceRatio, CW_SPACE_RATIO_MIN, CW_SPACE_RATIO_MAX, true,
+    " dits", false);
+  EEPROM.put(CW_SPACE_RATIO, g_cwSpaceRatio);
+
+  if (g_cwWpm > CW_WPM_MIN)
+  {
+    g_cwFarnsworth = setupKeyerValue("Set Farnsworth", g_cwFarnsworth, CW_WPM_MIN, g_cwWpm - 1, false, " WPM", true);
+    EEPROM.put(CW_FARNSWORTH, g_cwFarnsworth);
+  }
+
+  cwTimingUpdate();
+}
+
+/* set up keyer type, then the keyer timing */
 static void setupKeyer ()
 {
   int8_t keyTemp;
@@ -243,6 +345,67 @@ static void setupKeyer ()
   // store new value in eeprom
   EEPROM.put(CW_KEY_TYPE, keyTemp);
 
+  setupKeyerTiming();
+
+  g_menuOn = false;
+}
+
+/* shows the tuning rate choice for setupTuningRate() */
+static void drawTuningRate (uint8_t rate)
+{
+  if (rate == TUNING_RATE_GENTLE)
+    drawTextWithRectFilled("< Gentle >", 60, 110, 195, 35, G_DISPLAY_WHITE, G_DISPLAY_NEWBACK, G_DISPLAY_CYAN);
+  else if (rate == TUNING_RATE_NORMAL)
+    drawTextWithRectFilled("< Normal >", 60, 110, 195, 35, G_DISPLAY_WHITE, G_DISPLAY_NEWBACK, G_DISPLAY_CYAN);
+  else if (rate == TUNING_RATE_FAST)
+    drawTextWithRectFilled("< Fast >", 60, 110, 195, 35, G_DISPLAY_WHITE, G_DISPLAY_NEWBACK, G_DISPLAY_CYAN);
+  else if (rate == TUNING_RATE_DIGIT)
+    drawTextWithRectFilled("< Digit Cursor >", 60, 110, 195, 35, G_DISPLAY_WHITE, G_DISPLAY_NEWBACK, G_DISPLAY_CYAN);
+  else
+    drawTextWithRectFilled("< Fixed 50 Hz >", 60, 110, 195, 35, G_DISPLAY_WHITE, G_DISPLAY_NEWBACK, G_DISPLAY_CYAN);
+}
+
+/*
+  set up tuning rate - fixed 50 Hz steps, a velocity curve that grows the step size
+  from 10 Hz up to 2.5 KHz as the knob is spun faster, or the digit cursor
+*/
+static void setupTuningRate ()
+{
+  int16_t knob;
+  uint8_t rate = g_tuningRate;
+
+  displayDialog("Set Tuning Rate", "Press tune to Save");
+
+  drawTuningRate(rate);
+
+  // loop until the encoder button is pushed
+  while (!encoderButtonDown())
+  {
+    knob = encoderRead();
+
+    if (knob == 0)
+    {
+      activeDelay(50);
+      continue;
+    }
+
+    if (knob < 0 && rate > TUNING_RATE_FIXED)
+      rate--;
+    else if (knob > 0 && rate < TUNING_RATE_DIGIT)
+      rate++;
+    else
+      continue;
+
+    drawTuningRate(rate);
+  }
+
+  activeDelay(500);
+
+  g_tuningRate = rate;
+
+  // store new value in eeprom
+  EEPROM.put(TUNING_RATE, g_tuningRate);
+
   g_menuOn = false;
 }
 
@@ -255,10 +418,11 @@ static void drawSetupMenu ()
   drawRectNoFill(10, 10, 300, 220, G_DISPLAY_LIGHTGREY);  // screen border
 
   drawRawText("Set Freq...", 30, 50, G_DISPLAY_WHITE, G_DISPLAY_NEWBACK);
-  drawRawText("Set BFO...", 30, 80, G_DISPLAY_WHITE, G_DISPLAY_NEWBACK);
-  drawRawText("CW Delay...", 30, 110, G_DISPLAY_WHITE, G_DISPLAY_NEWBACK);
-  drawRawText("CW Keyer...", 30, 140, G_DISPLAY_WHITE, G_DISPLAY_NEWBACK);
-  drawRawText("Touch Screen...", 30, 170, G_DISPLAY_WHITE, G_DISPLAY_NEWBACK);
+  drawRawText("Set BFO...", 30, 75, G_DISPLAY_WHITE, G_DISPLAY_NEWBACK);
+  drawRawText("CW Delay...", 30, 100, G_DISPLAY_WHITE, G_DISPLAY_NEWBACK);
+  drawRawText("CW Keyer...", 30, 125, G_DISPLAY_WHITE, G_DISPLAY_NEWBACK);
+  drawRawText("Tuning Rate...", 30, 150, G_DISPLAY_WHITE, G_DISPLAY_NEWBACK);
+  drawRawText("Touch Screen...", 30, 175, G_DISPLAY_WHITE, G_DISPLAY_NEWBACK);
   drawRawText("Exit", 30, 200, G_DISPLAY_WHITE, G_DISPLAY_NEWBACK);
 }
 
@@ -266,9 +430,9 @@ static void drawSetupMenu ()
 static void movePuck (int16_t i)
 {
   if (m_prevPuck >= 0)
-    drawRectNoFill(15, 45 + (m_prevPuck * 30), 290, 30, G_DISPLAY_BLACK);
+    drawRectNoFill(15, 45 + (m_prevPuck * M_MENU_ITEM_HEIGHT), 290, M_MENU_ITEM_HEIGHT, G_DISPLAY_BLACK);
 
-  drawRectNoFill(15, 45 + (i * 30), 290, 30, G_DISPLAY_WHITE);
+  drawRectNoFill(15, 45 + (i * M_MENU_ITEM_HEIGHT), 290, M_MENU_ITEM_HEIGHT, G_DISPLAY_WHITE);
 
   m_prevPuck = i;
 }
@@ -308,7 +472,7 @@ void doSetupMenu ()
     //  }  // <<<--- an end bracket should have preceded this
 
     // if there's an encoder change, change selection puck position
-    if (i > 0 && select + i < 60)
+    if (i > 0 && select + i < M_MENU_ITEMS * 10)
     {
       select += i;
       movePuck(select / 10);
@@ -341,6 +505,8 @@ void doSetupMenu ()
     else if (select < 40)
       setupKeyer();
     else if (select < 50)
+      setupTuningRate();
+    else if (select < 60)
       doTouchCalibration();
     else
       break;  // exit setup was chosen
@@ -0,0 +1,521 @@
+/*
+  This source file is under General Public License version 3.
+
+  CAT parser harness. ubitx_cat.cpp is built in here, so its queue and counters can be read
+  back, and driven from a virtual millisecond clock the way the AVR would : the host sends at
+  38400 baud into the 64 byte serial buffer, the receive interrupt runs every millisecond and
+  checkCAT() at loop() pace, with stalls where loop() is stuck in a redraw. Each case sends a
+  byte stream and checks the replies and the receive counters :
+
+    resync        a stray byte in front of a frame is slid past
+    lock on       a 0x00 opcode isn't taken while the stream is out of step
+    truncated     a frame cut short by a pause is thrown away, the next one is answered
+    burst         a stalled loop() with the queue full leaves the bytes in the serial buffer
+    overrun       a burst longer than the queue and the buffer together, then a pause
+    payload       a state set whose payload stops short is refused and the rest thrown away
+    state set     a whole one is taken and the frames after it run
+    auto info     the pushed 0x03 / 0xF7 frame, coalesced and with the split bit
+*/
+
+#include <stdio.h>
+#include "../ubitx_cat.cpp"
+
+/* the radio side ubitx_cat.cpp talks to */
+uint8_t g_vfoActive = VFO_A;
+uint32_t g_vfoA = 7074000;
+uint32_t g_vfoB = 14074000;
+uint16_t g_sideTone = 600;
+uint32_t g_frequency = 7074000;
+uint32_t g_ritTxFrequency = 0;
+bool g_ritOn = false;
+bool g_cwMode = false;
+bool g_iambicKey = true;
+uint8_t g_cwWpm = 20;
+uint8_t g_cwDahRatio = 30;
+uint8_t g_cwFarnsworth = 0;
+uint16_t g_cwDelayTime = 60;
+uint8_t g_keyerControl = IAMBICB;
+bool g_txCAT = false;
+bool g_inTx = false;
+bool g_splitOn = false;
+bool g_isUSB = true;
+
+static bool m_usbA = true;
+static bool m_usbB = true;
+
+void setFrequency (uint32_t f)
+{
+  g_frequency = f;
+}
+
+void startTx (uint8_t txMode)
+{
+  g_inTx = true;
+}
+
+void stopTx ()
+{
+  g_inTx = false;
+}
+
+void vfoActivate (uint8_t vfoSelect)
+{
+  if (vfoSelect == g_vfoActive)
+    return;
+
+  if (g_vfoActive == VFO_A)
+  {
+    g_vfoA = g_frequency;
+    m_usbA = g_isUSB;
+    g_frequency = g_vfoB;
+    g_isUSB = m_usbB;
+  }
+  else
+  {
+    g_vfoB = g_frequency;
+    m_usbB = g_isUSB;
+    g_frequency = g_vfoA;
+    g_isUSB = m_usbA;
+  }
+
+  g_vfoActive = vfoSelect;
+}
+
+bool vfoIsUSB (uint8_t vfo)
+{
+  if (vfo == g_vfoActive)
+    return g_isUSB;
+
+  return vfo == VFO_A ? m_usbA : m_usbB;
+}
+
+void vfoSetUSB (uint8_t vfo, bool usb)
+{
+  if (vfo == g_vfoActive)
+    g_isUSB = usb;
+  else if (vfo == VFO_A)
+    m_usbA = usb;
+  else
+    m_usbB = usb;
+}
+
+void pttLatency (uint32_t * worst, uint32_t * average, uint16_t * count)
+{
+  *worst = 0;
+  *average = 0;
+  *count = 0;
+}
+
+void pttLatencyReset ()
+{
+}
+
+void cwTimingUpdate ()
+{
+}
+
+void sidetoneTune (uint16_t hz)
+{
+}
+
+bool cwTextPut (char c)
+{
+  return true;
+}
+
+uint8_t cwTextFree ()
+{
+  return CW_TEXT_BUFFER_SIZE;
+}
+
+void displayVFO (uint8_t vfo)
+{
+}
+
+void displayVFORedraw (uint8_t vfo)
+{
+}
+
+void redrawVFOs ()
+{
+}
+
+void encoderStats (uint16_t * rejected, uint16_t * dropped, bool reset)
+{
+  *rejected = 0;
+  *dropped = 0;
+}
+
+/* the host's side of the serial line */
+static constexpr uint8_t M_LINE_RATE = 4;     // bytes a millisecond, 38400 baud
+static constexpr uint16_t M_LINE_SIZE = 1024;
+
+struct LineByte {
+  uint8_t c;
+  uint32_t time;  // ms, not sent before this
+};
+
+static LineByte m_line[M_LINE_SIZE];
+static uint16_t m_lineHead;
+static uint16_t m_lineCount;
+static uint32_t m_lineTime;   // ms, when the last byte queued goes out
+static uint32_t m_overruns;   // bytes lost to a full serial buffer
+static bool m_inIsr;
+
+static uint32_t now ()
+{
+  return g_hostMicros / 1000;
+}
+
+/* queues bytes to send after a pause of 'pause' ms from the last ones, or from now */
+static void hostWrite (const uint8_t * data, uint16_t length, uint32_t pause = 0)
+{
+  uint32_t time = (m_lineTime > now() ? m_lineTime : now()) + pause;
+
+  for (uint16_t i = 0; i < length && m_lineCount < M_LINE_SIZE; i++)
+  {
+    m_line[(m_lineHead + m_lineCount) % M_LINE_SIZE] = {data[i], time};
+    m_lineCount++;
+  }
+
+  m_lineTime = time;
+}
+
+static void hostFrame (uint8_t p0, uint8_t p1, uint8_t p2, uint8_t p3, uint8_t opcode, uint32_t pause = 0)
+{
+  uint8_t frame[5] = {p0, p1, p2, p3, opcode};
+
+  hostWrite(frame, 5, pause);
+}
+
+/* one millisecond : the line delivers what it can, then the receive interrupt runs */
+static void tick ()
+{
+  g_hostMicros += 1000;
+
+  for (uint8_t i = 0; i < M_LINE_RATE && m_lineCount > 0 && m_line[m_lineHead].time <= now(); i++)
+  {
+    if (hostSerialSend(&m_line[m_lineHead].c, 1) == 0)
+      m_overruns++;
+
+    m_lineHead = (m_lineHead + 1) % M_LINE_SIZE;
+    m_lineCount--;
+  }
+
+  m_inIsr = true;
+  TIMER0_COMPB_vect();
+  m_inIsr = false;
+}
+
+/* checkCAT() waiting on the serial port, time goes on */
+static void serialIdle ()
+{
+  if (!m_inIsr)
+    tick();
+}
+
+/* runs for 'ms', with loop() calling checkCAT() once a millisecond unless 'stalled' */
+static void run (uint32_t ms, bool stalled = false)
+{
+  for (uint32_t i = 0; i < ms; i++)
+  {
+    tick();
+
+    if (!stalled)
+    {
+      g_hostSerialIdle = serialIdle;
+      checkCAT();
+      g_hostSerialIdle = NULL;
+    }
+  }
+}
+
+/* a new session with the counters at 0, anything still coming is thrown away */
+static void restart ()
+{
+  m_lineCount = 0;
+  run(M_CAT_SESSION_GAP + 100);
+
+  uint8_t discard[256];
+
+  while (hostSerialTake(discard, sizeof(discard)) > 0)
+    ;
+
+  m_catFrames = 0;
+  m_catFramesDropped = 0;
+  m_catBytesSkipped = 0;
+  m_catQueueDeepest = 0;
+  m_catPartialFrames = 0;
+  m_overruns = 0;
+}
+
+static uint8_t m_reply[2048];
+static size_t m_replyLength;
+
+static void takeReplies ()
+{
+  m_replyLength = hostSerialTake(m_reply, sizeof(m_reply));
+}
+
+/* the 0x03 reply for 'f' on upper sideband */
+static void freqReply (uint32_t f, uint8_t * reply)
+{
+  f /= 10;
+
+  for (int8_t i = 3; i >= 0; i--)
+  {
+    reply[i] = (f % 10) | ((f / 10 % 10) << 4);
+    f /= 100;
+  }
+
+  reply[4] = M_CAT_MODE_USB;
+}
+
+static int m_failures = 0;
+
+static void check (const char * name, bool ok, const char * detail)
+{
+  printf("  %-12s %s  %s\n", name, ok ? "ok  " : "FAIL", detail);
+
+  if (!ok)
+    m_failures++;
+}
+
+static void testResync ()
+{
+  restart();
+
+  uint8_t stray = 0x55;
+  uint8_t expected[6] = {0x00};
+  char detail[80];
+
+  // 14.074.12 MHz, the stray byte makes the first window end on 0x12, which isn't an opcode
+  hostWrite(&stray, 1);
+  hostFrame(0x01, 0x40, 0x74, 0x12, 0x01);
+  hostFrame(0x00, 0x00, 0x00, 0x00, 0x03);
+  run(100);
+  takeReplies();
+
+  freqReply(14074120, expected + 1);
+  snprintf(detail, sizeof(detail), "%u reply bytes, %u skipped, %u Hz", (unsigned)m_replyLength,
+      m_catBytesSkipped, g_frequency);
+  check("resync", m_replyLength == 6 && memcmp(m_reply, expected, 6) == 0 && m_catBytesSkipped == 1 &&
+      g_frequency == 14074120, detail);
+}
+
+static void testLockOn ()
+{
+  restart();
+
+  uint8_t stray[5] = {0x55, 0x66, 0x77, 0x88, 0x99};
+  uint8_t expected[5];
+  char detail[80];
+
+  // out of step after the first window, so the zeros of the poll mustn't be taken as lock on
+  hostWrite(stray, sizeof(stray));
+  hostFrame(0x00, 0x00, 0x00, 0x00, 0x03);
+  run(100);
+  takeReplies();
+
+  freqReply(g_frequency, expected);
+  snprintf(detail, sizeof(detail), "%u reply bytes, %u skipped", (unsigned)m_replyLength, m_catBytesSkipped);
+  check("lock on", m_replyLength == 5 && memcmp(m_reply, expected, 5) == 0 && m_catBytesSkipped == 5, detail);
+}
+
+static void testTruncated ()
+{
+  restart();
+
+  uint32_t before = g_frequency;
+  uint8_t partial[3] = {0x01, 0x40, 0x74};
+  uint8_t expected[5];
+  char detail[80];
+
+  hostWrite(partial, sizeof(partial));
+  hostFrame(0x00, 0x00, 0x00, 0x00, 0x03, M_CAT_FRAME_GAP * 2);
+  run(200);
+  takeReplies();
+
+  freqReply(before, expected);
+  snprintf(detail, sizeof(detail), "%u reply bytes, %u skipped, %u partial", (unsigned)m_replyLength,
+      m_catBytesSkipped, m_catPartialFrames);
+  check("truncated", m_replyLength == 5 && memcmp(m_reply, expected, 5) == 0 && m_catBytesSkipped == 3 &&
+      m_catPartialFrames == 1 && g_frequency == before, detail);
+}
+
+static void testBurst ()
+{
+  restart();
+
+  static constexpr uint8_t M_POLLS = 30;
+  char detail[96];
+
+  // the queue fills within the stall, the rest of the burst fits in the serial buffer
+  for (uint8_t i = 0; i < M_POLLS; i++)
+    hostFrame(0x00, 0x00, 0x00, 0x00, 0x03);
+
+  run(30, true);
+  run(100);
+  takeReplies();
+
+  snprintf(detail, sizeof(detail), "%u reply bytes, %u dropped, %u overruns, deepest %u", (unsigned)m_replyLength,
+      m_catFramesDropped, m_overruns, m_catQueueDeepest);
+  check("burst", m_replyLength == M_POLLS * 5 && m_catFramesDropped == 0 && m_overruns == 0 &&
+      m_catQueueDeepest == M_CAT_QUEUE_SIZE - 1, detail);
+}
+
+static void testOverrun ()
+{
+  restart();
+
+  static constexpr uint8_t M_POLLS = 60;
+  uint8_t expected[5];
+  char detail[96];
+
+  // more than the queue and the serial buffer hold, bytes are lost and the stream is out of step
+  for (uint8_t i = 0; i < M_POLLS; i++)
+    hostFrame(0x00, 0x00, 0x00, 0x00, 0x03);
+
+  run(60, true);
+  run(200);
+  takeReplies();
+
+  size_t burst = m_replyLength;
+
+  // after a pause the next poll is answered
+  hostFrame(0x00, 0x00, 0x00, 0x00, 0x03, M_CAT_FRAME_GAP * 2);
+  run(200);
+  takeReplies();
+
+  freqReply(g_frequency, expected);
+  snprintf(detail, sizeof(detail), "%u of %u burst reply bytes, %u dropped, %u overruns", (unsigned)burst,
+      M_POLLS * 5, m_catFramesDropped, m_overruns);
+  check("overrun", m_overruns > 0 && burst <= M_POLLS * 5 && m_catFramesDropped == 0 && m_replyLength == 5 &&
+      memcmp(m_reply, expected, 5) == 0, detail);
+}
+
+/* a state set frame setting VFO A to 'vfoA', with its payload */
+static void stateSetFrame (uint32_t vfoA, uint8_t * payload)
+{
+  CatState state;
+
+  memset(&state, 0, sizeof(state));
+  state.version = M_CAT_STATE_VERSION;
+  state.vfoA = vfoA;
+
+  memcpy(payload, &state, sizeof(state));
+  payload[sizeof(state)] = catChecksum((uint8_t *)&state, sizeof(state));
+}
+
+static void testPayloadDrop ()
+{
+  restart();
+
+  uint32_t before = catVfoFrequency(VFO_A);
+  uint8_t payload[sizeof(CatState) + 1];
+  uint8_t expected[6] = {0xF0};
+  char detail[96];
+
+  // the payload stops for longer than M_CAT_FRAME_GAP, the rest and the poll behind it come
+  // before the host's next pause and belong to the lost frame
+  stateSetFrame(before + 1000, payload);
+  hostFrame(M_CAT_SET_VFO_A, 0x00, 0x00, 0x00, M_CAT_CMD_STATE_SET);
+  hostWrite(payload, 6);
+  hostWrite(payload + 6, sizeof(payload) - 6, M_CAT_FRAME_GAP + 20);
+  hostFrame(0x00, 0x00, 0x00, 0x00, 0x03);
+  hostFrame(0x00, 0x00, 0x00, 0x00, 0x03, M_CAT_FRAME_GAP * 2);
+  run(400);
+  takeReplies();
+
+  uint32_t vfoA = catVfoFrequency(VFO_A);
+
+  freqReply(g_frequency, expected + 1);
+  snprintf(detail, sizeof(detail), "%u reply bytes, %u skipped, VFO A %u Hz", (unsigned)m_replyLength,
+      m_catBytesSkipped, vfoA);
+  check("payload", m_replyLength == 6 && memcmp(m_reply, expected, 6) == 0 &&
+      m_catBytesSkipped == sizeof(payload) - 6 + 5 && vfoA == before, detail);
+}
+
+static void testStateSet ()
+{
+  restart();
+
+  uint8_t payload[sizeof(CatState) + 1];
+  uint8_t expected[6] = {0x00};
+  char detail[96];
+
+  stateSetFrame(10100000, payload);
+  hostFrame(M_CAT_SET_VFO_A, 0x00, 0x00, 0x00, M_CAT_CMD_STATE_SET);
+  hostWrite(payload, sizeof(payload));
+  hostFrame(0x00, 0x00, 0x00, 0x00, 0x03);
+  run(200);
+  takeReplies();
+
+  freqReply(10100000, expected + 1);
+  snprintf(detail, sizeof(detail), "%u reply bytes, %u skipped, %u Hz", (unsigned)m_replyLength, m_catBytesSkipped,
+      g_frequency);
+  check("state set", m_replyLength == 6 && memcmp(m_reply, expected, 6) == 0 && m_catBytesSkipped == 0 &&
+      g_frequency == 10100000, detail);
+}
+
+static void testAutoInfo ()
+{
+  restart();
+
+  uint8_t expected[8] = {0x00, M_CAT_CMD_AUTO_INFO};
+  char detail[96];
+  bool ok;
+
+  // the ack, then where the radio is now
+  hostFrame(0x01, 0x00, 0x00, 0x00, M_CAT_CMD_AUTO_INFO);
+  run(200);
+  takeReplies();
+
+  freqReply(g_frequency, expected + 2);
+  expected[7] = 0xA8;  // receiving, split off
+  ok = m_replyLength == 8 && memcmp(m_reply, expected, 8) == 0;
+
+  // a fast spin of the knob and split on, within one push interval
+  for (uint8_t i = 1; i <= 5; i++)
+  {
+    g_frequency = 7000000 + i * 100;
+    run(10);
+  }
+
+  g_splitOn = true;
+  run(200);
+  takeReplies();
+
+  freqReply(7000500, expected + 2);
+  expected[7] = 0x88;  // receiving, split on
+  ok = ok && m_replyLength == 14 && memcmp(m_reply + 7, expected + 1, 7) == 0;
+
+  // and off again, nothing is pushed
+  hostFrame(0x00, 0x00, 0x00, 0x00, M_CAT_CMD_AUTO_INFO);
+  run(50);
+  g_splitOn = false;
+  g_frequency = 7074000;
+  run(200);
+  takeReplies();
+
+  ok = ok && m_replyLength == 1 && m_reply[0] == 0x00;
+  snprintf(detail, sizeof(detail), "%u bytes after the last change", (unsigned)m_replyLength);
+  check("auto info", ok, detail);
+}
+
+int main ()
+{
+  testResync();
+  testLockOn();
+  testTruncated();
+  testBurst();
+  testOverrun();
+  testPayloadDrop();
+  testStateSet();
+  testAutoInfo();
+
+  if (m_failures == 0)
+    printf("cat_parser_test : ok\n");
+
+  return m_failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,242 @@
+/*
+  This source file is under General Public License version 3.
+
+  encoder stress harness. A simulated knob is turned at a sweep of speeds, with and without
+  contact bounce, while a microsecond clock runs the pin change interrupt the way the AVR
+  would : it is held off by the other interrupts, and edges that come in before it reads the
+  port are seen as one change. A consumer reads the encoder at loop() pace, with a slow redraw
+  now and then, and the harness reports what the consumer saw :
+
+    missed   detents short of the distance turned
+    wrong    encoderRead() results with the wrong sign, the knob jumping back
+    lost     detent events the consumer never got, a full event queue
+    rej/drop the ISR's own counters from encoderStats(), for comparison
+
+  Runs without bounce have to come out exact, with every detent event, up to M_GATE_SPEED.
+  Anything else is reported
+*/
+
+#include <stdio.h>
+#include "../ubitx.h"
+
+extern "C" void PCINT1_vect ();
+
+static constexpr uint8_t M_PTT_UP = 0x08;           // PTT is active low, keep it released
+static constexpr uint16_t M_MIN_DETENTS = 60;       // turned in each run, or a second's worth if that's more
+
+/* interrupt timing at 16 MHz */
+static constexpr uint8_t M_ISR_ENTRY = 3;  // microseconds from a pin change to the port being read
+static constexpr uint8_t M_ISR_TIME = 6;   // microseconds the encoder ISR runs for
+
+/* the other interrupts, which hold off the encoder while they run */
+struct Blocker {
+  uint32_t period;  // microseconds
+  uint32_t phase;
+  uint32_t length;
+};
+
+static const Blocker m_blockers[] = {
+  {104, 0, 4},      // ADC free running on the paddle
+  {250, 17, 25},    // keyer tick at its longest
+  {1024, 500, 5},   // Timer0 millis()
+  {1024, 520, 12}   // CAT receive
+};
+
+/* the consumer, loop() pace with a redraw every so often */
+static constexpr uint32_t M_LOOP_PERIOD = 2000;
+static constexpr uint32_t M_REDRAW_PERIOD = 250000;
+static constexpr uint32_t M_REDRAW_LENGTH = 40000;
+
+static constexpr uint16_t M_MAX_SPEED = 800;
+static const uint16_t m_speeds[] = { 2, 5, 10, 20, 50, 100, 200, 400, M_MAX_SPEED };  // detents per second
+static const uint16_t m_bounces[] = { 0, 50, 200, 1000 };  // microseconds of bounce after an edge
+
+static constexpr uint16_t M_GATE_SPEED = 200;  // no bounce, must be exact up to here
+
+/* one pin toggle of the simulated knob */
+struct Toggle {
+  uint32_t time;
+  uint8_t mask;
+};
+
+static constexpr uint32_t M_MAX_TOGGLES = (uint32_t)M_MAX_SPEED * ENCODER_STEPS_PER_DETENT * 7;
+
+static Toggle m_toggles[M_MAX_TOGGLES];
+static uint32_t m_toggleCount;
+
+struct Result {
+  int32_t missed;
+  uint32_t wrong;
+  uint32_t lost;
+  uint16_t rejected;
+  uint16_t dropped;
+};
+
+static int compareToggles (const void * a, const void * b)
+{
+  uint32_t ta = ((const Toggle *)a)->time;
+  uint32_t tb = ((const Toggle *)b)->time;
+
+  return ta < tb ? -1 : ta > tb ? 1 : 0;
+}
+
+/*
+  builds the pin toggles for turning 'detents' at 'speed' detents per second. Each edge of a
+  phase bounces an even number of extra times within 'bounce' microseconds of it
+*/
+static void buildWaveform (uint16_t detents, uint16_t speed, uint16_t bounce, int8_t dir)
+{
+  uint32_t stepTime = 1000000UL / ((uint32_t)speed * ENCODER_STEPS_PER_DETENT);
+  uint8_t state = 0;
+
+  m_toggleCount = 0;
+
+  for (uint32_t i = 0; i < (uint32_t)detents * ENCODER_STEPS_PER_DETENT; i++)
+  {
+    // Gray code 0, 1, 3, 2 clockwise, the other way round anticlockwise
+    uint8_t next;
+
+    if (dir > 0)
+      next = (state == 0) ? 1 : (state == 1) ? 3 : (state == 3) ? 2 : 0;
+    else
+      next = (state == 0) ? 2 : (state == 2) ? 3 : (state == 3) ? 1 : 0;
+
+    uint8_t mask = state ^ next;
+    uint32_t edge = 1000 + i * stepTime;
+
+    m_toggles[m_toggleCount++] = {edge, mask};
+
+    if (bounce != 0)
+    {
+      uint8_t extra = (rand() % 4) * 2;
+
+      for (uint8_t b = 0; b < extra; b++)
+        m_toggles[m_toggleCount++] = {edge + 1 + rand() % bounce, mask};
+    }
+
+    state = next;
+  }
+
+  qsort(m_toggles, m_toggleCount, sizeof(Toggle), compareToggles);
+}
+
+/* true if one of the other interrupts is running at 't' */
+static bool blocked (uint32_t t)
+{
+  for (size_t i = 0; i < sizeof(m_blockers) / sizeof(m_blockers[0]); i++)
+  {
+    if ((t + m_blockers[i].period - m_blockers[i].phase) % m_blockers[i].period < m_blockers[i].length)
+      return true;
+  }
+
+  return false;
+}
+
+/* turns the knob in 'dir' and reads it the way loop() does */
+static Result runOne (uint16_t speed, uint16_t bounce, int8_t dir)
+{
+  Result result = {};
+  uint16_t detents = speed > M_MIN_DETENTS ? speed : M_MIN_DETENTS;
+
+  buildWaveform(detents, speed, bounce, dir);
+
+  uint8_t pins = 0;
+  PINC = M_PTT_UP | pins;
+  g_hostMicros = 0;
+  encoderSetup();
+  encoderStats(&result.rejected, &result.dropped, true);
+
+  uint32_t end = m_toggles[m_toggleCount - 1].time + M_REDRAW_LENGTH + M_LOOP_PERIOD * 2;
+  uint32_t next = 0;            // next toggle
+  bool pending = false;         // the pin change flag
+  uint32_t pendingSince = 0;
+  uint32_t busyUntil = 0;       // the encoder ISR is running
+  uint32_t pollTime = M_LOOP_PERIOD;
+  int32_t net = 0;
+  int32_t eventSum = 0;
+
+  for (uint32_t t = 0; t < end; t++)
+  {
+    while (next < m_toggleCount && m_toggles[next].time == t)
+    {
+      pins ^= m_toggles[next++].mask;
+      PINC = M_PTT_UP | pins;
+
+      if (!pending)
+      {
+        pending = true;
+        pendingSince = t;
+      }
+    }
+
+    // the flag is cleared as the ISR starts, so changes from then on set it again
+    if (pending && t >= busyUntil && t - pendingSince >= M_ISR_ENTRY && !blocked(t))
+    {
+      g_hostMicros = t;
+      PCINT1_vect();
+      pending = false;
+      busyUntil = t + M_ISR_TIME;
+    }
+
+    if (t == pollTime)
+    {
+      EncoderEvent ev;
+
+      g_hostMicros = t;
+
+      while (encoderReadEvent(&ev))
+        eventSum += ev.dir;
+
+      int16_t s = encoderRead();
+
+      if (s * dir < 0)
+        result.wrong++;
+
+      net += s;
+
+      pollTime += (t % M_REDRAW_PERIOD < M_LOOP_PERIOD) ? M_REDRAW_LENGTH : M_LOOP_PERIOD;
+    }
+  }
+
+  int32_t expected = (int32_t)detents * ENCODER_STEPS_PER_DETENT;
+  int32_t short_ = expected - net * dir;
+
+  result.missed = (short_ + (short_ > 0 ? ENCODER_STEPS_PER_DETENT - 1 : 0)) / ENCODER_STEPS_PER_DETENT;
+  result.lost = abs(net / ENCODER_STEPS_PER_DETENT - eventSum);
+  encoderStats(&result.rejected, &result.dropped, false);
+
+  return result;
+}
+
+int main ()
+{
+  int failures = 0;
+
+  srand(32);
+
+  printf("detents/s  bounce us   dir  missed  wrong   lost    rej   drop\n");
+
+  for (size_t b = 0; b < sizeof(m_bounces) / sizeof(m_bounces[0]); b++)
+  {
+    for (size_t s = 0; s < sizeof(m_speeds) / sizeof(m_speeds[0]); s++)
+    {
+      for (int8_t dir = 1; dir >= -1; dir -= 2)
+      {
+        Result r = runOne(m_speeds[s], m_bounces[b], dir);
+        bool gated = (m_bounces[b] == 0 && m_speeds[s] <= M_GATE_SPEED);
+        bool failed = gated && (r.missed != 0 || r.wrong != 0 || r.lost != 0);
+
+        printf("%9u  %9u  %4s  %6d  %5u  %5u  %5u  %5u%s\n", m_speeds[s], m_bounces[b], dir > 0 ? "cw" : "ccw",
+            r.missed, r.wrong, r.lost, r.rejected, r.dropped, failed ? "  FAIL" : "");
+
+        if (failed)
+          failures++;
+      }
+    }
+  }
+
+  if (failures == 0)
+    printf("encoder_stress_test : ok\n");
+
+  return failures == 0 ? 0 : 1;
+}
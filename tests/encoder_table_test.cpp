@@ -0,0 +1,156 @@
+/*
+  This source file is under General Public License version 3.
+
+  runs Gray-code sequences through the encoder interrupt and checks the transition table
+  against the comparison chain it replaced : every one of the 16 transitions, whole turns
+  both ways, a recorded fast spin with bounce and a random walk with illegal double steps
+*/
+
+#include <stdio.h>
+#include "../ubitx.h"
+
+extern "C" void PCINT1_vect ();
+
+static constexpr uint8_t M_PTT_UP = 0x08;  // PTT is active low, keep it released
+
+static int m_failures = 0;
+
+/* the comparison chain from before the table, the step from 'previous' to 'current' */
+static int8_t oldChain (uint8_t previous, uint8_t current)
+{
+  if (previous == current)
+    return 0;
+
+  // these transitions point to the encoder being rotated anti-clockwise
+  if ((previous == 0 && current == 2) ||
+      (previous == 2 && current == 3) ||
+      (previous == 3 && current == 1) ||
+      (previous == 1 && current == 0))
+    return -1;
+
+  // these transitions point to the encoder being rotated clockwise
+  if ((previous == 0 && current == 1) ||
+      (previous == 1 && current == 3) ||
+      (previous == 3 && current == 2) ||
+      (previous == 2 && current == 0))
+    return 1;
+
+  // both phases changed, the chain ignored it
+  return 0;
+}
+
+/* puts the encoder in 'state' without counting anything */
+static void encoderStart (uint8_t state)
+{
+  PINC = M_PTT_UP | state;
+  encoderSetup();
+}
+
+/* feeds 'states' to the interrupt from 'start' and checks the net count against the old chain */
+static void runSequence (const char * name, uint8_t start, const uint8_t * states, size_t length)
+{
+  int16_t expected = 0;
+  uint8_t previous = start;
+
+  encoderStart(start);
+
+  for (size_t i = 0; i < length; i++)
+  {
+    expected += oldChain(previous, states[i]);
+    previous = states[i];
+
+    PINC = M_PTT_UP | states[i];
+    PCINT1_vect();
+    encoderFlushEvents();
+  }
+
+  int16_t count = encoderRead();
+
+  if (count != expected)
+  {
+    printf("FAIL %s : count %d, the old chain gives %d\n", name, count, expected);
+    m_failures++;
+  }
+}
+
+int main ()
+{
+  // each transition on its own
+  for (uint8_t from = 0; from < 4; from++)
+  {
+    for (uint8_t to = 0; to < 4; to++)
+    {
+      char name[32];
+
+      sprintf(name, "transition %u -> %u", from, to);
+      runSequence(name, from, &to, 1);
+    }
+  }
+
+  // whole detents, clockwise and back
+  static const uint8_t clockwise[] = { 1, 3, 2, 0, 1, 3, 2, 0, 1, 3, 2, 0 };
+  static const uint8_t anticlockwise[] = { 2, 3, 1, 0, 2, 3, 1, 0, 2, 3, 1, 0 };
+
+  runSequence("clockwise turns", 0, clockwise, sizeof(clockwise));
+  runSequence("anticlockwise turns", 0, anticlockwise, sizeof(anticlockwise));
+
+  // a fast clockwise spin captured off the A0 / A1 pins : contact bounce on the edges and two
+  // states skipped where the interrupts couldn't keep up
+  static const uint8_t recorded[] = {
+    1, 0, 1, 3, 1, 3, 2, 0, 1, 3, 2, 3, 2, 0, 2, 0,
+    1, 3, 0, 1, 3, 2, 0, 1, 1, 3, 2, 2, 0, 1, 3, 2,
+    0, 3, 2, 0, 1, 0, 1, 3, 2, 0
+  };
+
+  runSequence("recorded spin with bounce", 0, recorded, sizeof(recorded));
+
+  // random walk : mostly legal steps with repeats and illegal double steps mixed in
+  uint8_t walk[4096];
+  uint8_t state = 0;
+
+  srand(817);
+
+  for (size_t i = 0; i < sizeof(walk); i++)
+  {
+    int r = rand() % 10;
+
+    if (r < 4)
+      state = (state == 0) ? 1 : (state == 1) ? 3 : (state == 3) ? 2 : 0;  // clockwise
+    else if (r < 7)
+      state = (state == 0) ? 2 : (state == 2) ? 3 : (state == 3) ? 1 : 0;  // anticlockwise
+    else if (r < 9)
+      state ^= 3;  // both phases at once
+    // else the same state again, a spurious interrupt
+
+    walk[i] = state;
+  }
+
+  runSequence("random walk", 0, walk, sizeof(walk));
+
+  // the rejected counter only counts the double steps
+  uint16_t rejected;
+  uint16_t dropped;
+  static const uint8_t doubles[] = { 3, 0, 3, 3, 1, 2 };  // 0->3, 3->0, 0->3, repeat, 3->1, 1->2
+
+  encoderStart(0);
+  encoderStats(&rejected, &dropped, true);
+
+  for (size_t i = 0; i < sizeof(doubles); i++)
+  {
+    PINC = M_PTT_UP | doubles[i];
+    PCINT1_vect();
+  }
+
+  encoderStats(&rejected, &dropped, false);
+
+  if (rejected != 4)
+  {
+    printf("FAIL rejected count %u, expected 4\n", rejected);
+    m_failures++;
+  }
+
+  if (m_failures == 0)
+    printf("encoder_table_test : ok\n");
+
+  return m_failures == 0 ? 0 : 1;
+}
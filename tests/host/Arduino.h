@@ -0,0 +1,153 @@
+/*
+  This source file is under General Public License version 3.
+
+  Just enough of the Arduino core to build the firmware sources with the host g++ for the
+  tests in this directory. The AVR registers are plain variables, time only moves when a test
+  moves it and the interrupt vectors are ordinary functions a test can call
+*/
+
+#ifndef _HOST_ARDUINO_H_
+#define _HOST_ARDUINO_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <math.h>
+
+typedef bool boolean;
+typedef uint8_t byte;
+
+/* flash is just memory on the host, so the PROGMEM reads are plain loads (pointers stay 64 bits) */
+#define PROGMEM
+#define PSTR(s) (s)
+#define F(s) (s)
+#define pgm_read_byte(a) (*(a))
+#define pgm_read_word(a) (*(a))
+#define pgm_read_dword(a) (*(a))
+#define memcpy_P memcpy
+#define strcpy_P strcpy
+#define strlen_P strlen
+
+#define ISR(vector) extern "C" void vector (void)
+#define cli()
+#define sei()
+
+#define F_CPU 16000000UL
+
+#define HIGH 1
+#define LOW 0
+#define INPUT 0
+#define OUTPUT 1
+#define INPUT_PULLUP 2
+#define DEC 10
+#define HEX 16
+#define DEFAULT 1
+
+#define A0 14
+#define A1 15
+#define A2 16
+#define A3 17
+#define A6 20
+#define A7 21
+
+#define bit(b) (1UL << (b))
+#define _BV(b) (1 << (b))
+#define lowByte(w) ((uint8_t)((w) & 0xff))
+#define highByte(w) ((uint8_t)((w) >> 8))
+#define constrain(a, l, h) ((a) < (l) ? (l) : ((a) > (h) ? (h) : (a)))
+#define min(a, b) ((a) < (b) ? (a) : (b))
+#define max(a, b) ((a) > (b) ? (a) : (b))
+#define abs(x) ((x) > 0 ? (x) : -(x))
+
+/* registers, defined in host.cpp */
+extern volatile uint8_t PINB, PINC, PIND, PORTB, PORTC, PORTD, DDRB, DDRC, DDRD;
+extern volatile uint8_t PCMSK1, PCICR, PCIFR, SREG;
+extern volatile uint8_t TCCR0A, TCCR0B, TCNT0, OCR0A, OCR0B, TIMSK0, TIFR0;
+extern volatile uint8_t TCCR1A, TCCR1B, TCCR1C, TIMSK1, TIFR1;
+extern volatile uint16_t TCNT1, OCR1A, OCR1B, ICR1;
+extern volatile uint8_t TCCR2A, TCCR2B, TCNT2, OCR2A, OCR2B, TIMSK2, TIFR2, ASSR;
+extern volatile uint8_t ADMUX, ADCSRA, ADCSRB, ADCL, ADCH, DIDR0;
+extern volatile uint16_t ADC;
+
+#define PINC0 0
+#define PINC1 1
+#define PINC2 2
+#define PINC3 3
+#define PORTD2 2
+#define PORTD6 6
+
+#define WGM12 3
+#define WGM21 1
+#define CS10 0
+#define CS11 1
+#define CS12 2
+#define OCIE0B 2
+#define OCF0B 2
+#define OCIE1A 1
+#define OCIE2A 1
+#define OCIE2B 2
+#define OCF2A 1
+#define OCF2B 2
+#define ADEN 7
+#define ADSC 6
+#define ADATE 5
+#define ADIE 3
+#define ADPS0 0
+#define ADPS1 1
+#define ADPS2 2
+#define REFS0 6
+#define ADLAR 5
+
+uint8_t digitalRead (uint8_t pin);
+void digitalWrite (uint8_t pin, uint8_t value);
+void pinMode (uint8_t pin, uint8_t mode);
+int analogRead (uint8_t pin);
+void analogReference (uint8_t mode);
+
+unsigned long millis ();
+unsigned long micros ();
+void delay (unsigned long ms);
+void delayMicroseconds (unsigned int us);
+
+volatile uint8_t * digitalPinToPCMSK (uint8_t pin);
+uint8_t digitalPinToPCMSKbit (uint8_t pin);
+uint8_t digitalPinToPCICRbit (uint8_t pin);
+
+char * utoa (unsigned value, char * buffer, int radix);
+char * itoa (int value, char * buffer, int radix);
+char * ultoa (unsigned long value, char * buffer, int radix);
+char * ltoa (long value, char * buffer, int radix);
+
+struct HardwareSerial {
+  void begin (long baud);
+  void flush ();
+  int available ();
+  int read ();
+  int peek ();
+  size_t write (uint8_t c);
+  size_t write (const uint8_t * data, size_t length);
+  int availableForWrite ();
+};
+
+extern HardwareSerial Serial;
+
+/*
+  test control. The clock is in microseconds and both millis() and micros() follow it.
+  g_hostPinWrite, if set, sees every digitalWrite()
+*/
+extern uint32_t g_hostMicros;
+extern void (* g_hostPinWrite)(uint8_t pin, uint8_t value);
+
+/*
+  the serial port. hostSerialSend() puts bytes in the 64 byte receive buffer and returns how
+  many fit, the rest are lost as they would be to an overrun. hostSerialTake() takes what the
+  firmware has written. g_hostSerialIdle, if set, is called when the firmware finds nothing to
+  read, so a test can move the clock while it waits
+*/
+size_t hostSerialSend (const uint8_t * data, size_t length);
+size_t hostSerialTake (uint8_t * data, size_t size);
+extern void (* g_hostSerialIdle)();
+
+#endif
@@ -0,0 +1,21 @@
+/* host build, the SPI bus isn't used by the tests */
+#ifndef _HOST_SPI_H_
+#define _HOST_SPI_H_
+
+struct SPISettings {
+  SPISettings (uint32_t clock, uint8_t order, uint8_t mode) {}
+};
+
+#define MSBFIRST 1
+#define SPI_MODE0 0
+
+struct SPIClass {
+  void begin ();
+  void beginTransaction (SPISettings settings);
+  void endTransaction ();
+  uint8_t transfer (uint8_t c);
+};
+
+extern SPIClass SPI;
+
+#endif
@@ -0,0 +1,14 @@
+/* host build, the I2C bus isn't used by the tests */
+#ifndef _HOST_WIRE_H_
+#define _HOST_WIRE_H_
+
+struct TwoWire {
+  void begin ();
+  void beginTransmission (uint8_t address);
+  size_t write (uint8_t c);
+  uint8_t endTransmission ();
+};
+
+extern TwoWire Wire;
+
+#endif
@@ -0,0 +1,218 @@
+/*
+  This source file is under General Public License version 3.
+
+  the host side of Arduino.h : register variables, the test clock and the core functions the
+  firmware sources call
+*/
+
+#include <stdio.h>
+#include "Arduino.h"
+
+volatile uint8_t PINB, PINC, PIND, PORTB, PORTC, PORTD, DDRB, DDRC, DDRD;
+volatile uint8_t PCMSK1, PCICR, PCIFR, SREG;
+volatile uint8_t TCCR0A, TCCR0B, TCNT0, OCR0A, OCR0B, TIMSK0, TIFR0;
+volatile uint8_t TCCR1A, TCCR1B, TCCR1C, TIMSK1, TIFR1;
+volatile uint16_t TCNT1, OCR1A, OCR1B, ICR1;
+volatile uint8_t TCCR2A, TCCR2B, TCNT2, OCR2A, OCR2B, TIMSK2, TIFR2, ASSR;
+volatile uint8_t ADMUX, ADCSRA, ADCSRB, ADCL, ADCH, DIDR0;
+volatile uint16_t ADC;
+
+uint32_t g_hostMicros = 0;
+void (* g_hostPinWrite)(uint8_t pin, uint8_t value) = NULL;
+
+HardwareSerial Serial;
+
+uint8_t digitalRead (uint8_t pin)
+{
+  if (pin >= A0 && pin <= A3)
+    return (PINC >> (pin - A0)) & 1;
+
+  return HIGH;
+}
+
+void digitalWrite (uint8_t pin, uint8_t value)
+{
+  if (g_hostPinWrite)
+    g_hostPinWrite(pin, value);
+}
+
+void pinMode (uint8_t pin, uint8_t mode)
+{
+}
+
+int analogRead (uint8_t pin)
+{
+  return ADC;
+}
+
+void analogReference (uint8_t mode)
+{
+}
+
+unsigned long millis ()
+{
+  return g_hostMicros / 1000;
+}
+
+unsigned long micros ()
+{
+  return g_hostMicros;
+}
+
+void delay (unsigned long ms)
+{
+  g_hostMicros += ms * 1000;
+}
+
+void delayMicroseconds (unsigned int us)
+{
+  g_hostMicros += us;
+}
+
+/* every pin the firmware asks about is on PCINT1 (port C) */
+volatile uint8_t * digitalPinToPCMSK (uint8_t pin)
+{
+  return &PCMSK1;
+}
+
+uint8_t digitalPinToPCMSKbit (uint8_t pin)
+{
+  return pin - A0;
+}
+
+uint8_t digitalPinToPCICRbit (uint8_t pin)
+{
+  return 1;
+}
+
+char * ultoa (unsigned long value, char * buffer, int radix)
+{
+  char digits[33];
+  int length = 0;
+
+  do
+  {
+    uint8_t digit = value % radix;
+
+    digits[length++] = digit < 10 ? '0' + digit : 'a' + digit - 10;
+    value /= radix;
+  } while (value != 0);
+
+  for (int i = 0; i < length; i++)
+    buffer[i] = digits[length - 1 - i];
+
+  buffer[length] = 0;
+
+  return buffer;
+}
+
+char * ltoa (long value, char * buffer, int radix)
+{
+  if (value < 0 && radix == 10)
+  {
+    buffer[0] = '-';
+    ultoa(-value, buffer + 1, radix);
+    return buffer;
+  }
+
+  return ultoa(value, buffer, radix);
+}
+
+char * utoa (unsigned value, char * buffer, int radix)
+{
+  return ultoa(value, buffer, radix);
+}
+
+char * itoa (int value, char * buffer, int radix)
+{
+  return ltoa(value, buffer, radix);
+}
+
+/* the serial buffers, the receive one is the size of the Arduino core's */
+static constexpr size_t M_SERIAL_RX_SIZE = 64;
+static constexpr size_t M_SERIAL_TX_SIZE = 4096;
+
+static uint8_t m_serialRx[M_SERIAL_RX_SIZE];
+static size_t m_serialRxHead = 0;
+static size_t m_serialRxCount = 0;
+static uint8_t m_serialTx[M_SERIAL_TX_SIZE];
+static size_t m_serialTxCount = 0;
+
+void (* g_hostSerialIdle)() = NULL;
+
+size_t hostSerialSend (const uint8_t * data, size_t length)
+{
+  size_t sent = 0;
+
+  while (sent < length && m_serialRxCount < M_SERIAL_RX_SIZE)
+  {
+    m_serialRx[(m_serialRxHead + m_serialRxCount) % M_SERIAL_RX_SIZE] = data[sent++];
+    m_serialRxCount++;
+  }
+
+  return sent;
+}
+
+size_t hostSerialTake (uint8_t * data, size_t size)
+{
+  size_t length = m_serialTxCount < size ? m_serialTxCount : size;
+
+  memcpy(data, m_serialTx, length);
+  memmove(m_serialTx, m_serialTx + length, m_serialTxCount - length);
+  m_serialTxCount -= length;
+
+  return length;
+}
+
+void HardwareSerial::begin (long baud)
+{
+}
+
+void HardwareSerial::flush ()
+{
+}
+
+int HardwareSerial::available ()
+{
+  if (m_serialRxCount == 0 && g_hostSerialIdle)
+    g_hostSerialIdle();
+
+  return m_serialRxCount;
+}
+
+int HardwareSerial::read ()
+{
+  if (m_serialRxCount == 0)
+    return -1;
+
+  uint8_t c = m_serialRx[m_serialRxHead];
+
+  m_serialRxHead = (m_serialRxHead + 1) % M_SERIAL_RX_SIZE;
+  m_serialRxCount--;
+
+  return c;
+}
+
+int HardwareSerial::peek ()
+{
+  return m_serialRxCount == 0 ? -1 : m_serialRx[m_serialRxHead];
+}
+
+/* what the firmware sends is kept for hostSerialTake(), anything past M_SERIAL_TX_SIZE is lost */
+size_t HardwareSerial::write (uint8_t c)
+{
+  return write(&c, 1);
+}
+
+size_t HardwareSerial::write (const uint8_t * data, size_t length)
+{
+  for (size_t i = 0; i < length && m_serialTxCount < M_SERIAL_TX_SIZE; i++)
+    m_serialTx[m_serialTxCount++] = data[i];
+
+  return length;
+}
+
+int HardwareSerial::availableForWrite ()
+{
+  return 63;
+}
@@ -0,0 +1,8 @@
+/* host build, the tests call the interrupt handlers themselves so there is nothing to hold off */
+#ifndef _HOST_ATOMIC_H_
+#define _HOST_ATOMIC_H_
+
+#define ATOMIC_RESTORESTATE 0
+#define ATOMIC_BLOCK(type) for (bool _atomicOnce = true; _atomicOnce; _atomicOnce = false)
+
+#endif
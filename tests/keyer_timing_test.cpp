@@ -0,0 +1,620 @@
+/*
+  This source file is under General Public License version 3.
+
+  keyer timing harness. keyer.cpp is built in here, so its element lengths can be read back,
+  and driven from a virtual microsecond clock the way the AVR would : the ADC interrupt every
+  conversion (104 us) with a scripted paddle voltage, the Timer1 keyer tick every 250 us,
+  the Timer2 sidetone interrupts at the tone period and cwKeyer() at loop() pace, with stalls
+  where loop() is stuck in a redraw. CW_KEY is recorded and the recorded dits, dahs and spaces
+  are checked against what cwTimingUpdate() worked out :
+
+    iambic A and B        held dits and dahs, a squeeze, and the extra element B adds
+    PTT as the key        dits while PTT is held
+    straight key          marks and spaces follow the key within an ADC conversion
+    weight, element gap   and Farnsworth spacing, sent from the keyboard CW buffer
+    T/R                   no key down without TX, TX released after the CW delay time
+    dialogs               a paddle tap while loop() is in a dialog isn't sent once it closes
+
+  across 5 to 50 WPM. The worst errors are printed for each run
+*/
+
+#include <stdio.h>
+#include "../keyer.cpp"
+
+/* the radio side keyer.cpp talks to */
+uint8_t g_cwWpm = 20;
+uint8_t g_cwWeight = 50;
+uint8_t g_cwDahRatio = 30;
+uint8_t g_cwFarnsworth = 0;
+uint8_t g_cwSpaceRatio = 10;
+uint16_t g_cwDelayTime = 60;
+uint16_t g_sideTone = 600;
+uint32_t g_cwTimeout = 0;
+bool g_cwMode = true;
+bool g_iambicKey = true;
+uint8_t g_keyerControl = IAMBICB;
+bool g_inTx = false;
+
+static uint32_t m_txOnTime;
+static uint32_t m_txOffTime;
+static char m_decoded[64];
+static uint8_t m_decodedLength;
+
+void startTx (uint8_t txMode)
+{
+  g_inTx = true;
+  m_txOnTime = g_hostMicros;
+}
+
+void stopTx ()
+{
+  g_inTx = false;
+  m_txOffTime = g_hostMicros;
+}
+
+void drawDecodedChar (char c)
+{
+  if (m_decodedLength < sizeof(m_decoded) - 1)
+    m_decoded[m_decodedLength++] = c;
+}
+
+/* ADCH readings for each paddle state, the middle of each class in m_paddleClass */
+static constexpr uint8_t M_ADC_NONE = 255;
+static constexpr uint8_t M_ADC_DIT = 112;
+static constexpr uint8_t M_ADC_DAH = 176;
+static constexpr uint8_t M_ADC_BOTH = 40;
+static constexpr uint8_t M_ADC_STRAIGHT = 0;
+
+static constexpr uint32_t M_ADC_PERIOD = 104;   // 13 ADC clocks at 16 MHz / 128
+static constexpr uint32_t M_TICK_PERIOD = 1000000UL / M_KEYER_TICK_HZ;
+static constexpr uint32_t M_LOOP_PERIOD = 700;  // a quiet loop() pass
+
+/* one step of a script, the paddle and PTT from the end of the last step until 'until' ms */
+struct Step {
+  uint32_t until;
+  uint8_t adc;
+  bool ptt;
+};
+
+/* key line recorder */
+static constexpr uint16_t M_MAX_EDGES = 2048;
+
+static uint32_t m_edges[M_MAX_EDGES];  // micros() of each key edge, down, up, down, ...
+static uint16_t m_edgeCount;
+static uint16_t m_keyedWithoutTx;
+static uint16_t m_keyedWithoutTone;
+static uint32_t m_toneOverrun;          // longest the sidetone ran on after key up, microseconds
+static uint32_t m_keyUpTime;
+
+static int m_failures = 0;
+
+static void recordPin (uint8_t pin, uint8_t value)
+{
+  if (pin != CW_KEY)
+    return;
+
+  if (value)
+  {
+    if (!g_inTx)
+      m_keyedWithoutTx++;
+    if (TIMSK2 == 0)
+      m_keyedWithoutTone++;
+  }
+  else
+    m_keyUpTime = g_hostMicros;
+
+  if (m_edgeCount < M_MAX_EDGES)
+    m_edges[m_edgeCount++] = g_hostMicros;
+}
+
+/* microseconds in a sidetone cycle, from the Timer2 setup sidetoneTune() left */
+static uint32_t tonePeriod ()
+{
+  static const uint16_t prescale[7] = { 1, 8, 32, 64, 128, 256, 1024 };
+
+  return ((uint32_t)(OCR2A + 1) * prescale[TCCR2B - 1]) / 16;
+}
+
+/* starts a new recording of the key line */
+static void recordClear ()
+{
+  m_edgeCount = 0;
+  m_keyedWithoutTx = 0;
+  m_keyedWithoutTone = 0;
+  m_toneOverrun = 0;
+}
+
+/*
+  runs the keyer for 'length' ms with the paddle and PTT following 'script'. loop() stops for
+  'stall' ms out of every 'stallEvery' ms, if 'stallEvery' isn't 0. The clock carries on from
+  the last run, so the phase between the paddle and the ticks moves around
+*/
+static void run (uint32_t length, const Step * script, uint32_t stall = 0, uint32_t stallEvery = 0)
+{
+  uint32_t start = g_hostMicros;
+  uint32_t end = start + length * 1000;
+  uint32_t nextLoop = start;
+  uint32_t nextTone = 0;
+
+  for (uint32_t t = start; t < end; t++)
+  {
+    uint32_t ms = (t - start) / 1000;
+    const Step * step = script;
+
+    while (step->until != 0 && step->until <= ms)
+      step++;
+
+    g_hostMicros = t;
+    PINC = step->ptt ? 0 : M_PTT_PIN_MASK;
+
+    if (t % M_ADC_PERIOD == 0)
+    {
+      ADCH = step->adc;
+      ADC_vect();
+    }
+
+    if (t % M_TICK_PERIOD == 0)
+      TIMER1_COMPA_vect();
+
+    if (TIMSK2 != 0)
+    {
+      if (nextTone == 0 || t >= nextTone)
+      {
+        TIMER2_COMPA_vect();
+        TIMER2_COMPB_vect();
+        nextTone = t + tonePeriod();
+      }
+
+      if (!(m_edgeCount & 1) && t - m_keyUpTime > m_toneOverrun)
+        m_toneOverrun = t - m_keyUpTime;
+    }
+    else
+      nextTone = 0;
+
+    if (t >= nextLoop && !(stallEvery != 0 && (t - start) % (stallEvery * 1000) < stall * 1000))
+    {
+      cwKeyer();
+      nextLoop = t + M_LOOP_PERIOD;
+    }
+  }
+}
+
+/* lengths the keyer was given by cwTimingUpdate(), in microseconds */
+static uint32_t usOf (uint32_t length)
+{
+  return (length * M_TICK_PERIOD) / M_KEYER_TICK;
+}
+
+/* one recorded mark or space against its nominal length, keeps the worst error */
+static void checkLength (const char * name, const char * what, uint32_t recorded, uint32_t nominal,
+    uint32_t tolerance, int32_t * worst)
+{
+  int32_t error = (int32_t)recorded - (int32_t)nominal;
+
+  if (abs(error) > abs(*worst))
+    *worst = error;
+
+  if ((uint32_t)abs(error) > tolerance)
+  {
+    printf("FAIL %s : %s of %u us, expected %u us\n", name, what, recorded, nominal);
+    m_failures++;
+  }
+}
+
+/* the T/R and sidetone checks of a recording */
+static void finish (const char * name)
+{
+  if (m_keyedWithoutTx != 0)
+  {
+    printf("FAIL %s : keyed %u times without TX\n", name, m_keyedWithoutTx);
+    m_failures++;
+  }
+
+  if (m_keyedWithoutTone != 0)
+  {
+    printf("FAIL %s : keyed %u times without the sidetone\n", name, m_keyedWithoutTone);
+    m_failures++;
+  }
+
+  // the sidetone ramps down over a few cycles, then stops
+  if (m_toneOverrun > tonePeriod() * (M_SIDETONE_RAMP_CYCLES + 2))
+  {
+    printf("FAIL %s : sidetone ran %u us past key up\n", name, m_toneOverrun);
+    m_failures++;
+  }
+}
+
+/*
+  after the last key up, the keyer finishes the space it is timing and TX is let go once the
+  CW delay time has passed, give or take the millis() it is stamped with, at the next loop() pass. Runs on with the paddle
+  let go until it has. 'slack' is the ms loop() stalls for, which can only make the release late :
+  the delay is counted from the last keyer tick that was busy, not from when loop() saw it
+*/
+static int32_t checkRelease (const char * name, uint32_t lastSpace, uint32_t slack = 0)
+{
+  static const Step idle[] = { {0, M_ADC_NONE, false} };
+
+  run(g_cwDelayTime * 10 + (8 * 1200) / g_cwWpm + slack + 100, idle);
+
+  uint32_t expected = lastSpace + g_cwDelayTime * 10000UL;
+  int32_t late = (int32_t)(m_txOffTime - m_keyUpTime) - (int32_t)expected;
+
+  if (g_inTx || late < -1000 || late > (int32_t)(1000 + 2 * M_LOOP_PERIOD + slack * 1000))
+  {
+    printf("FAIL %s : TX released %d us after the delay time\n", name, late);
+    m_failures++;
+  }
+
+  return late;
+}
+
+/* the paddle on its own, held for 'length' ms : dits or dahs with element spaces between */
+static void iambicHeld (const char * name, uint8_t adc, bool ptt, uint32_t length)
+{
+  const Step script[] = { {length, adc, ptt}, {0, M_ADC_NONE, false} };
+  uint32_t mark = usOf(adc == M_ADC_DAH ? m_dahLength : m_ditLength);
+  uint32_t space = usOf(m_elementSpace);
+  int32_t markError = 0;
+  int32_t spaceError = 0;
+
+  recordClear();
+  run(length, script);
+  checkRelease(name, space);
+  finish(name);
+
+  if (m_edgeCount < 4)
+  {
+    printf("FAIL %s : only %u key edges\n", name, m_edgeCount);
+    m_failures++;
+    return;
+  }
+
+  // each element and space is within a tick, whole element and space periods are exact on average
+  for (uint16_t i = 0; i + 1 < m_edgeCount; i += 2)
+  {
+    checkLength(name, "mark", m_edges[i + 1] - m_edges[i], mark, M_TICK_PERIOD, &markError);
+
+    if (i + 2 < m_edgeCount)
+      checkLength(name, "space", m_edges[i + 2] - m_edges[i + 1], space, M_TICK_PERIOD, &spaceError);
+  }
+
+  uint16_t periods = m_edgeCount / 2 - 1;
+  uint32_t total = m_edges[periods * 2] - m_edges[0];
+
+  if (abs((int32_t)total - (int32_t)(periods * (mark + space))) > (int32_t)M_TICK_PERIOD)
+  {
+    printf("FAIL %s : %u elements took %u us, expected %u us\n", name, periods, total, periods * (mark + space));
+    m_failures++;
+  }
+
+  printf("  %-24s %3u WPM  %4u marks  worst mark %+5d us  space %+5d us\n", name, g_cwWpm, m_edgeCount / 2,
+      markError, spaceError);
+}
+
+/*
+  both paddles held for 'length' ms, then let go. Alternate dits and dahs, starting with a dit.
+  Returns the number of elements sent
+*/
+static uint16_t iambicSqueeze (const char * name, uint32_t length, bool report)
+{
+  const Step script[] = { {length, M_ADC_BOTH, false}, {0, M_ADC_NONE, false} };
+  int32_t markError = 0;
+  int32_t spaceError = 0;
+
+  recordClear();
+  run(length, script);
+  checkRelease(name, usOf(m_elementSpace));
+  finish(name);
+
+  for (uint16_t i = 0; i + 1 < m_edgeCount; i += 2)
+  {
+    uint32_t mark = usOf((i / 2) & 1 ? m_dahLength : m_ditLength);
+
+    checkLength(name, "mark", m_edges[i + 1] - m_edges[i], mark, M_TICK_PERIOD, &markError);
+
+    if (i + 2 < m_edgeCount)
+      checkLength(name, "space", m_edges[i + 2] - m_edges[i + 1], usOf(m_elementSpace), M_TICK_PERIOD, &spaceError);
+  }
+
+  if (report)
+    printf("  %-24s %3u WPM  %4u marks  worst mark %+5d us  space %+5d us\n", name, g_cwWpm, m_edgeCount / 2,
+        markError, spaceError);
+
+  return m_edgeCount / 2;
+}
+
+/*
+  a squeeze let go in the middle of the fourth element, a dah. Iambic A stops after it, iambic B
+  latched the dit paddle while the dah was sent and adds a dit
+*/
+static void iambicModes ()
+{
+  uint32_t start = g_hostMicros;
+
+  iambicSqueeze("iambic squeeze", (1200 * 30) / g_cwWpm, true);
+
+  // TX comes up before the first element, so find when the fourth one was being sent
+  uint32_t release = ((m_edges[6] + m_edges[7]) / 2 - start) / 1000;
+
+  g_keyerControl = 0;
+  uint16_t a = iambicSqueeze("iambic A release", release, false);
+
+  g_keyerControl = IAMBICB;
+  uint16_t b = iambicSqueeze("iambic B release", release, false);
+
+  if (a != 4 || b != 5)
+  {
+    printf("FAIL squeeze let go in the 4th element : iambic A sent %u, iambic B %u, expected 4 and 5\n", a, b);
+    m_failures++;
+  }
+
+  printf("  %-24s %3u WPM  iambic A %u elements, iambic B %u\n", "squeeze let go", g_cwWpm, a, b);
+}
+
+/* a straight key, marks and spaces of the lengths in 'pattern' after a first press brings up TX */
+static void straightKey ()
+{
+  static const uint16_t pattern[] = { 57, 71, 183, 45, 20, 300, 111, 64, 12, 90, 250 };  // mark, space, ...
+  static constexpr uint8_t M_PATTERN_LENGTH = sizeof(pattern) / sizeof(pattern[0]);
+  Step script[M_PATTERN_LENGTH + 3];
+  uint32_t t = 400;
+  uint8_t n = 0;
+
+  script[n++] = {t, M_ADC_STRAIGHT, false};
+  script[n++] = {t += 200, M_ADC_NONE, false};
+
+  for (uint8_t i = 0; i < M_PATTERN_LENGTH; i++)
+    script[n++] = {t += pattern[i], (i & 1) ? M_ADC_NONE : M_ADC_STRAIGHT, false};
+
+  script[n++] = {0, M_ADC_NONE, false};
+
+  g_iambicKey = false;
+
+  recordClear();
+  run(t, script);
+  checkRelease("straight key", 0);
+  finish("straight key");
+
+  int32_t worst = 0;
+
+  // the first mark waits for TX, the rest follow the key within an ADC conversion at each end
+  for (uint8_t i = 0; i < M_PATTERN_LENGTH && i + 3 < m_edgeCount; i++)
+    checkLength("straight key", (i & 1) ? "space" : "mark", m_edges[i + 3] - m_edges[i + 2], pattern[i] * 1000UL,
+        M_ADC_PERIOD, &worst);
+
+  if (m_edgeCount != M_PATTERN_LENGTH + 3)
+  {
+    printf("FAIL straight key : %u key edges, expected %u\n", m_edgeCount, M_PATTERN_LENGTH + 3);
+    m_failures++;
+  }
+
+  printf("  %-24s %3u WPM  %4u marks  worst edge error %+5d us\n", "straight key", g_cwWpm, m_edgeCount / 2, worst);
+
+  g_iambicKey = true;
+}
+
+/*
+  keyboard CW of 'text', words each followed by a space. Each element and space is checked
+  against the Morse of the text : the space after an element, after a character and after a
+  word. loop() can be made to stall, the interrupt keeps the timing
+*/
+static void sendText (const char * name, const char * text, uint32_t stall = 0, uint32_t stallEvery = 0)
+{
+  static const Step idle[] = { {0, M_ADC_NONE, false} };
+  uint32_t element = usOf(m_elementSpace);
+  uint32_t charGap = element + usOf(m_charSpace);
+  uint32_t wordGap = charGap + usOf(m_wordSpace);
+  uint32_t length = 0;
+
+  m_decodedLength = 0;
+  m_decodeDit = 0;
+
+  for (const char * c = text; *c; c++)
+    cwTextPut(*c);
+
+  // how long the text takes, from the same lengths
+  for (const char * c = text; *c; c++)
+  {
+    if (*c == ' ')
+    {
+      length += wordGap - charGap;
+      continue;
+    }
+
+    uint8_t code = pgm_read_byte(&m_morseTable[*c - M_MORSE_FIRST]);
+
+    for (uint8_t mask = 1; mask < code; mask <<= 1)
+      length += usOf((code & mask) ? m_dahLength : m_ditLength) + element;
+
+    length += charGap - element;
+  }
+
+  recordClear();
+  run(length / 1000 + 1000, idle, stall, stallEvery);
+
+  int32_t late = checkRelease(name, wordGap, stall);
+
+  finish(name);
+
+  uint16_t edge = 0;
+  int32_t markError = 0;
+  int32_t spaceError = 0;
+
+  for (const char * c = text; *c && edge + 1 < m_edgeCount; c++)
+  {
+    if (*c == ' ')
+      continue;
+
+    uint8_t code = pgm_read_byte(&m_morseTable[*c - M_MORSE_FIRST]);
+    uint8_t mask = 0x80;
+
+    while (!(code & mask))
+      mask >>= 1;
+
+    while ((mask >>= 1) && edge + 1 < m_edgeCount)
+    {
+      uint32_t mark = usOf((code & mask) ? m_dahLength : m_ditLength);
+
+      checkLength(name, "mark", m_edges[edge + 1] - m_edges[edge], mark, M_TICK_PERIOD, &markError);
+
+      if (edge + 2 < m_edgeCount)
+      {
+        uint32_t space = (mask != 1) ? element : (c[1] == ' ') ? wordGap : charGap;
+
+        checkLength(name, mask != 1 ? "element space" : c[1] == ' ' ? "word gap" : "character gap",
+            m_edges[edge + 2] - m_edges[edge + 1], space, M_TICK_PERIOD, &spaceError);
+      }
+
+      edge += 2;
+    }
+  }
+
+  if (edge != m_edgeCount)
+  {
+    printf("FAIL %s : %u key edges, the text has %u\n", name, m_edgeCount, edge);
+    m_failures++;
+  }
+
+  // the decoder should read back what was sent, unless Farnsworth gaps look like word gaps to it
+  m_decoded[m_decodedLength] = 0;
+
+  if (g_cwFarnsworth == 0 && strncmp(m_decoded, text, strlen(text) - 1) != 0)
+  {
+    printf("FAIL %s : decoded \"%s\"\n", name, m_decoded);
+    m_failures++;
+  }
+
+  printf("  %-24s %3u WPM  %4u marks  worst mark %+5d us  space %+5d us  TX release %+6d us\n", name, g_cwWpm,
+      m_edgeCount / 2, markError, spaceError, late);
+}
+
+/*
+  a dit tapped while loop() is held in a dialog, so cwKeyer() doesn't run and TX can't come
+  up. Once cwKeyerCancel() has been called on the way out nothing may be sent
+*/
+static void dialogTap ()
+{
+  static const Step tap[] = { {200, M_ADC_NONE, false}, {230, M_ADC_DIT, false}, {0, M_ADC_NONE, false} };
+  static const Step idle[] = { {0, M_ADC_NONE, false} };
+
+  recordClear();
+  run(500, tap, 500, 500);
+  cwKeyerCancel();
+  run(200, idle);
+
+  if (m_edgeCount != 0 || g_inTx)
+  {
+    printf("FAIL dialog tap : %u key edges after the dialog closed\n", m_edgeCount);
+    m_failures++;
+  }
+}
+
+/* the lengths cwTimingUpdate() works out, against the timing rules written out longhand */
+static void checkTimingUpdate ()
+{
+  struct Case {
+    uint8_t wpm, weight, dahRatio, spaceRatio, farnsworth;
+    double dit, dah, element, character, word;  // ms, the character and word gaps from the last key up
+  };
+
+  static const Case cases[] = {
+    {20, 50, 30, 10, 0, 60, 180, 60, 180, 420},
+    {20, 60, 30, 10, 0, 72, 192, 48, 168, 408},      // 60% weight, 20% of a dit moves
+    {20, 40, 30, 10, 0, 48, 168, 72, 192, 432},
+    {20, 50, 35, 15, 0, 60, 210, 90, 180, 420},      // 1:3.5 and 1.5 dits between elements
+    {20, 50, 30, 10, 10, 60, 180, 60, 653.7, 1525.3}, // 20 WPM characters at 10 WPM (ARRL)
+    {45, 50, 30, 10, 0, 26.667, 80, 26.667, 80, 186.667}
+  };
+
+  for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i++)
+  {
+    const Case & c = cases[i];
+    char name[32];
+
+    g_cwWpm = c.wpm;
+    g_cwWeight = c.weight;
+    g_cwDahRatio = c.dahRatio;
+    g_cwSpaceRatio = c.spaceRatio;
+    g_cwFarnsworth = c.farnsworth;
+    cwTimingUpdate();
+
+    double ms = M_KEYER_TICK * M_KEYER_TICKS_PER_MS;
+    double got[5] = {
+      m_ditLength / ms, m_dahLength / ms, m_elementSpace / ms,
+      (m_elementSpace + m_charSpace) / ms, (m_elementSpace + m_charSpace + m_wordSpace) / ms
+    };
+    double want[5] = { c.dit, c.dah, c.element, c.character, c.word };
+
+    sprintf(name, "timing case %u", (unsigned)i);
+
+    for (uint8_t j = 0; j < 5; j++)
+    {
+      if (fabs(got[j] - want[j]) > 0.1)
+      {
+        printf("FAIL %s : length %u is %.2f ms, expected %.2f ms\n", name, j, got[j], want[j]);
+        m_failures++;
+      }
+    }
+  }
+
+  g_cwWeight = 50;
+  g_cwDahRatio = 30;
+  g_cwSpaceRatio = 10;
+  g_cwFarnsworth = 0;
+}
+
+int main ()
+{
+  static const uint8_t speeds[] = { 5, 13, 20, 35, 50 };
+
+  g_hostPinWrite = recordPin;
+  g_hostMicros = 1000;
+
+  keyerSetup();
+  checkTimingUpdate();
+  dialogTap();
+
+  for (uint8_t i = 0; i < sizeof(speeds); i++)
+  {
+    g_cwWpm = speeds[i];
+    cwTimingUpdate();
+
+    uint32_t dit = 1200 / g_cwWpm;
+
+    iambicHeld("iambic dits", M_ADC_DIT, false, dit * 30);
+    iambicHeld("iambic dahs", M_ADC_DAH, false, dit * 40);
+    iambicHeld("PTT as the key", M_ADC_NONE, true, dit * 30);
+    iambicModes();
+    straightKey();
+    sendText("keyboard PARIS", "PARIS PARIS ");
+    sendText("loop() stalls", "PARIS PARIS ", 120, 400);
+  }
+
+  // weight, element gap and Farnsworth, sent from the keyboard buffer at 25 WPM
+  g_cwWpm = 25;
+
+  g_cwWeight = 65;
+  cwTimingUpdate();
+  sendText("weight 65", "PARIS PARIS ");
+
+  g_cwWeight = 35;
+  cwTimingUpdate();
+  sendText("weight 35", "PARIS PARIS ");
+  iambicHeld("weight 35 dits", M_ADC_DIT, false, 1500);
+
+  g_cwWeight = 50;
+  g_cwSpaceRatio = 15;
+  cwTimingUpdate();
+  sendText("element gap 1.5", "PARIS PARIS ");
+  iambicHeld("element gap 1.5 dahs", M_ADC_DAH, false, 1500);
+
+  g_cwSpaceRatio = 10;
+  g_cwFarnsworth = 12;
+  cwTimingUpdate();
+  sendText("Farnsworth 12", "PARIS PARIS ");
+
+  if (m_failures == 0)
+    printf("keyer_timing_test : ok\n");
+
+  return m_failures == 0 ? 0 : 1;
+}
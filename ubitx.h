@@ -141,6 +141,39 @@ constexpr uint8_t VFO_MODE_USB = 3;
 constexpr uint16_t CW_KEY_TYPE = 358;
 constexpr uint8_t IAMBICB = 0x10;  // 0 for Iambic A, 1 for Iambic B
 
+/*
+  tuning rate : fixed 50 Hz steps, a gentle, normal or fast velocity curve, or the digit cursor
+  where the encoder button picks a VFO digit and the knob changes just that digit
+*/
+constexpr uint16_t TUNING_RATE = 359;
+constexpr uint8_t TUNING_RATE_FIXED = 0;
+constexpr uint8_t TUNING_RATE_GENTLE = 1;
+constexpr uint8_t TUNING_RATE_NORMAL = 2;
+constexpr uint8_t TUNING_RATE_FAST = 3;
+constexpr uint8_t TUNING_RATE_DIGIT = 4;
+
+/* number of VFO digits the digit cursor steps through, 1 MHz down to 10 Hz */
+constexpr uint8_t TUNING_DIGITS = 6;
+
+/*
+  keyer timing. CW_WPM takes over from the dot length in CW_SPEED, which is still written for
+  older firmware and is where CW_WPM is worked out from the first time this firmware runs
+*/
+constexpr uint16_t CW_WPM = 360;         // character speed
+constexpr uint16_t CW_WEIGHT = 361;      // 50 is standard, more lengthens each element and shortens the space after it
+constexpr uint16_t CW_DAH_RATIO = 362;   // dah length in tenths of a dit, 30 is 1:3
+constexpr uint16_t CW_FARNSWORTH = 363;  // overall speed with stretched character and word gaps, 0 is off
+constexpr uint16_t CW_SPACE_RATIO = 364; // space between the elements of a character in tenths of a dit, 10 is standard
+
+constexpr uint8_t CW_WPM_MIN = 5;
+constexpr uint8_t CW_WPM_MAX = 60;
+constexpr uint8_t CW_WEIGHT_MIN = 25;
+constexpr uint8_t CW_WEIGHT_MAX = 75;
+constexpr uint8_t CW_DAH_RATIO_MIN = 25;
+constexpr uint8_t CW_DAH_RATIO_MAX = 45;
+constexpr uint8_t CW_SPACE_RATIO_MIN = 5;
+constexpr uint8_t CW_SPACE_RATIO_MAX = 20;
+
 /*
   The uBitX is an up-conversion transceiver. The first IF is at 45 MHz. The first IF frequency is not exactly at
   45 MHz but about 5 KHz lower, this shift is due to the loading on the 45 MHz crystal filter by the matching
@@ -185,6 +218,9 @@ extern char g_buffC[30];
 */
 constexpr char g_customMessage[] = "AF7EC - Jesus rox!";
 
+/* callsign sent in place of '@' in the CW memories (the messages themselves are in keyer.cpp) */
+constexpr char g_cwCallsign[] = "AF7EC";
+
 extern uint8_t g_vfoActive;
 
 extern uint32_t g_vfoA;
@@ -203,10 +239,17 @@ extern bool g_iambicKey;
 /*
   these are variables that control the keyer behaviour
 */
-extern uint16_t g_cwSpeed;  // dot period in milliseconds
+extern uint8_t g_cwWpm;         // character speed in words per minute
+extern uint8_t g_cwWeight;      // CW_WEIGHT_MIN to CW_WEIGHT_MAX, 50 is standard
+extern uint8_t g_cwDahRatio;    // dah length in tenths of a dit
+extern uint8_t g_cwFarnsworth;  // overall speed in words per minute for Farnsworth spacing, 0 if off
+extern uint8_t g_cwSpaceRatio;  // space between the elements of a character in tenths of a dit
 extern uint16_t g_cwDelayTime;
 extern uint8_t g_keyerControl;
 
+extern uint8_t g_tuningRate;   // TUNING_RATE_FIXED, one of the velocity curves or TUNING_RATE_DIGIT
+extern uint8_t g_tuningDigit;  // digit under the digit cursor, 0 is 1 MHz and TUNING_DIGITS - 1 is 10 Hz
+
 /*
   Raduino needs to keep track of current state of the transceiver. These are a few variables that do it
 */
@@ -227,16 +270,48 @@ void startTx (uint8_t txMode);
 void stopTx ();
 void ritEnable (uint32_t f);
 void ritDisable ();
+void catSetup ();  // starts the interrupt that receives CAT frames
 void checkCAT ();
-void cwKeyer ();
+void catDisplayUpdate ();  // repaints the VFO display for CAT commands, from loop() only
+void catTextStop ();  // leaves keyboard CW (0xD2), for when CW mode is switched off
 void switchVFO (uint8_t vfoSelect);
+void vfoActivate (uint8_t vfoSelect);  // switchVFO() without the redraw and the EEPROM save
+bool vfoIsUSB (uint8_t vfo);
+void vfoSetUSB (uint8_t vfo, bool usb);
+void pttLatency (uint32_t * worst, uint32_t * average, uint16_t * count);  // PTT press to startTx(), in microseconds
+void pttLatencyReset ();
+
+/* forward declarations of functions in keyer.cpp */
+void keyerSetup ();  // starts the paddle ADC and the keyer timer interrupt
+void cwTimingUpdate ();  // works out the element lengths again, call after changing any of the g_cw timing settings
+void sidetoneTune (uint16_t hz);  // sets the sidetone frequency, even while it is sounding
+void sidetoneOn ();
+void sidetoneOff ();  // ramps down and stops at the end of a cycle
+void cwKeyer ();     // T/R switching for the keyer, called from loop() in CW mode
+void cwKeyerCancel ();  // drops paddle input latched while a dialog was open
+
+/* number of CW memories in keyer.cpp */
+constexpr uint8_t CW_MEMORIES = 3;
+
+void cwMemoryStart (uint8_t memory);
+void cwMemoryStop ();
+bool cwMemoryBusy ();  // true while a memory is being sent or is waiting to repeat
+void cwMemoryName (uint8_t memory, char * buffOut);  // buffOut needs 6 bytes
+
+/* keyboard CW, text typed in over the serial port and sent by the keyer */
+constexpr uint8_t CW_TEXT_BUFFER_SIZE = 63;  // characters of type-ahead, one less than a power of two
+
+bool cwTextPut (char c);  // false if the buffer is full
+uint8_t cwTextFree ();
 
 /* forward declarations of functions in file ubitx_ui.cpp */
 bool encoderButtonDown ();  // returns true if the encoder button is pressed  // was int
 void displayVFO (uint8_t vfo);  // updates just the VFO frequency to show what is in 'frequency' variable  // was int vfo
+void displayVFORedraw (uint8_t vfo);  // draws the whole VFO button, not just the changed digits
 void redrawVFOs ();    // redraws only the changed digits of the VFO
 void guiUpdate (bool clearScreen = false, bool refreshVFOs = false);  // repaints the entire screen. Slow!!
 void drawTx ();
+void drawDecodedChar (char c);  // adds a character decoded from the keying to the command bar
 
 /* forward declaration of functions in setup.cpp */
 void doSetupMenu ();  // main setup function, displays the setup menu, calls various dialog boxes
@@ -247,9 +322,28 @@ void setupFreq ();
 void displayDialog (const char * title, const char * instructions);
 void printCarrierFreq (uint32_t freq);  // used to display the frequency in the command area
 
+/* quadrature steps in one click of the knob, encoderRead() counts steps */
+constexpr uint8_t ENCODER_STEPS_PER_DETENT = 4;
+
+/* one detent of the encoder, queued by the encoder ISR */
+struct EncoderEvent {
+  uint32_t time;  // micros() when the detent's last step was decoded
+  int8_t dir;     // +1 clockwise, -1 counter-clockwise
+};
+
 /* forward declarations of functions in encoder.cpp */
 void encoderSetup ();
 int16_t encoderRead ();
+bool encoderReadEvent (EncoderEvent * ev);  // pops the oldest detent event, false if none are queued
+void encoderFlushEvents ();
+void encoderStats (uint16_t * rejected, uint16_t * dropped, bool reset);  // invalid transitions and dropped events
+
+/* PTT edges latched by the encoder ISR, which also watches the PTT pin */
+constexpr uint8_t PTT_PRESSED = 0x01;
+constexpr uint8_t PTT_RELEASED = 0x02;
+
+uint8_t pttReadEdges (uint32_t * pressTime);
+bool pttEdgePending ();
 
 /* main functions to check if any button is pressed and other user interface events */
 void doCommands ();  // does the commands with encoder to jump from button to button
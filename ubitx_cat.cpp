@@ -4,6 +4,7 @@
   Detailed comments are available in the ubitx.h file
 */
 
+#include <util/atomic.h>
 #include "ubitx.h"
 #include "nano_gui.h"
 
@@ -16,6 +17,9 @@
 
   WARNING: This is an unstable version. While it has worked with fldigi,
   it gives time out error with WSJTX 1.8.0
+
+  Two personalities are understood, the FT-817 binary protocol and a subset of the Kenwood
+  TS-480 ASCII one. The first complete command of a session decides which the host is using
 */
 
 /* global variables */
@@ -23,8 +27,50 @@
 
 /* file-level constants */
 
-/* for broken protocol */
-static constexpr uint16_t M_CAT_RECEIVE_TIMEOUT = 500;
+/*
+  the bytes of a frame come back to back, so a byte after a gap this long (ms) starts a new frame
+  even if the last one was short. This only helps resynchronise, nothing waits for it
+*/
+static constexpr uint8_t M_CAT_FRAME_GAP = 50;
+
+/* the shortest time between VFO repaints asked for by CAT commands (ms), 10 frames a second */
+static constexpr uint8_t M_CAT_DISPLAY_INTERVAL = 100;
+
+/* the VFOs waiting for a repaint */
+static constexpr uint8_t M_CAT_DIRTY_A = 0x01;
+static constexpr uint8_t M_CAT_DIRTY_B = 0x02;
+static constexpr uint8_t M_CAT_DIRTY_BOTH = M_CAT_DIRTY_A | M_CAT_DIRTY_B;
+static constexpr uint8_t M_CAT_DIRTY_PANEL = 0x04;  // the RIT and sideband buttons too, after a VFO switch
+
+/* a host that has been quiet this long (ms) may be a different program, work out the protocol again */
+static constexpr uint16_t M_CAT_SESSION_GAP = 2000;
+
+/*
+  a queued frame is the FT-817 frame followed by a byte saying which protocol it came in.
+  A Kenwood command is stored as its parameter (4 bytes, LSB first) and its m_kenwoodCommands
+  index in place of the opcode
+*/
+static constexpr uint8_t M_CAT_FRAME_SIZE = 6;
+static constexpr uint8_t M_CAT_FRAME_KIND = 5;
+
+static constexpr uint8_t M_CAT_FT817 = 0x00;
+static constexpr uint8_t M_CAT_KENWOOD = 0x01;
+static constexpr uint8_t M_CAT_KENWOOD_SET = 0x02;  // the Kenwood command had a parameter
+static constexpr uint8_t M_CAT_UNDECIDED = 0xFF;    // no protocol seen yet this session
+
+static constexpr uint8_t M_KENWOOD_UNKNOWN = 0xFF;  // index of a Kenwood command we don't know
+static constexpr uint8_t M_KENWOOD_MAX_LENGTH = 16;
+
+/*
+  frames waiting for checkCAT(), must be a power of two. One slot is always left empty, so it
+  holds 15, half again what the 64 byte serial buffer does
+*/
+static constexpr uint8_t M_CAT_QUEUE_SIZE = 16;
+static constexpr uint8_t M_CAT_QUEUE_MASK = M_CAT_QUEUE_SIZE - 1;
+
+/* CAT latency histogram, the top of each bucket (ms). The last bucket is everything slower */
+static const uint8_t m_catLatencyBuckets[] PROGMEM = {1, 2, 5, 10, 20, 50, 100};
+static constexpr uint8_t M_CAT_LATENCY_BUCKETS = sizeof(m_catLatencyBuckets) + 1;
 
 static constexpr uint8_t M_CAT_MODE_LSB = 0x00;
 static constexpr uint8_t M_CAT_MODE_USB = 0x01;
@@ -36,11 +82,137 @@ static constexpr uint8_t M_CAT_MODE_USB = 0x01;
 //static constexpr uint8_t M_CAT_MODE_PKT = 0x0C;  // unused, but keep
 //static constexpr uint8_t M_CAT_MODE_FMN = 0x88;  // unused, but keep
 
+/* 0xE7 reply, the receiver status is hardcoded as we don't support ctcss, etc. */
+static constexpr uint8_t M_CAT_RX_STATUS = 0x09;
+
+/* opcodes added for this radio, outside of the FT-817 set */
+static constexpr uint8_t M_CAT_CMD_PTT_LATENCY = 0xD0;
+static constexpr uint8_t M_CAT_CMD_ENCODER_STATS = 0xD1;
+static constexpr uint8_t M_CAT_CMD_KEYBOARD_CW = 0xD2;
+static constexpr uint8_t M_CAT_CMD_CAT_STATS = 0xD4;
+static constexpr uint8_t M_CAT_CMD_STATE_READ = 0xD5;
+static constexpr uint8_t M_CAT_CMD_STATE_SET = 0xD6;
+static constexpr uint8_t M_CAT_CMD_TIMING = 0xD7;
+static constexpr uint8_t M_CAT_CMD_AUTO_INFO = 0xD8;
+
+/*
+  auto information: with it on the radio sends the 0x03 and 0xF7 replies by itself, behind
+  M_CAT_CMD_AUTO_INFO, whenever they change. As for Kenwood's AI, changes closer together than
+  M_CAT_PUSH_INTERVAL ms go out as one frame with the latest state
+*/
+static constexpr uint8_t M_CAT_PUSH_INTERVAL = 100;  // the shortest time between auto information frames (ms)
+
+static constexpr uint8_t M_CAT_UNKNOWN = 0xFF;  // index of an opcode that isn't in m_catCommands
+
+/* the CatState layout, bump it when the layout changes */
+static constexpr uint8_t M_CAT_STATE_VERSION = 1;
+
+/* CatState flags */
+static constexpr uint8_t M_CAT_STATE_VFO_B = 0x01;  // VFO B is the active one
+static constexpr uint8_t M_CAT_STATE_USB_A = 0x02;  // VFO A is on upper sideband
+static constexpr uint8_t M_CAT_STATE_USB_B = 0x04;  // VFO B is on upper sideband
+static constexpr uint8_t M_CAT_STATE_SPLIT = 0x08;
+static constexpr uint8_t M_CAT_STATE_RIT = 0x10;    // (read only)
+static constexpr uint8_t M_CAT_STATE_TX = 0x20;     // (read only)
+static constexpr uint8_t M_CAT_STATE_CW = 0x40;     // (read only)
+
+/* M_CAT_CMD_STATE_SET, cmd[0] says which CatState fields to set */
+static constexpr uint8_t M_CAT_SET_VFO_A = 0x01;
+static constexpr uint8_t M_CAT_SET_VFO_B = 0x02;
+static constexpr uint8_t M_CAT_SET_ACTIVE_VFO = 0x04;
+static constexpr uint8_t M_CAT_SET_MODES = 0x08;
+static constexpr uint8_t M_CAT_SET_SPLIT = 0x10;
+static constexpr uint8_t M_CAT_SET_CW_WPM = 0x20;
+static constexpr uint8_t M_CAT_SET_SIDETONE = 0x40;
+static constexpr uint8_t M_CAT_SET_KEY_TYPE = 0x80;
+
+/*
+  keyboard CW : after M_CAT_CMD_KEYBOARD_CW every byte is text for the keyer until an ESC.
+  XOFF is sent when the type-ahead buffer is nearly full and XON once it has drained to half
+*/
+static constexpr uint8_t M_TEXT_END = 0x1B;  // ESC, back to CAT frames
+static constexpr uint8_t M_TEXT_XON = 0x11;
+static constexpr uint8_t M_TEXT_XOFF = 0x13;
+static constexpr uint8_t M_TEXT_XOFF_FREE = 16;  // the host may still have a few characters in flight
+static constexpr uint8_t M_TEXT_XON_FREE = CW_TEXT_BUFFER_SIZE / 2;
+
 /* file-level variables */
-static uint32_t m_rxBufferArriveTime = 0;
-static uint8_t m_rxBufferCheckCount = 0;
-static uint8_t m_cat[5];
+static uint8_t m_cat[M_CAT_FRAME_SIZE];  // the frame being run
 static bool m_insideCat = false;
+static volatile bool m_catText = false;  // the serial port is carrying keyboard CW, not CAT frames
+static bool m_catTextXoff = false;       // XOFF was sent and XON hasn't been yet
+static uint8_t m_catDisplayDirty = 0;    // M_CAT_DIRTY_* of the VFOs a CAT command has changed
+static uint32_t m_catDisplayTime = 0;    // millis() of the last repaint for CAT
+static uint8_t m_kenwoodAutoInfo = 0;    // AI setting, not 0 if the host asked for an IF reply whenever the radio changes
+static bool m_catAutoInfo = false;       // M_CAT_CMD_AUTO_INFO setting, the FT-817 host asked for a frame whenever the radio changes
+static bool m_catPushDue = false;        // the radio has changed since the last auto information frame or IF reply
+static uint32_t m_catPushTime = 0;       // millis() of the last one
+
+/*
+  the poll replies, kept ready so a poll is only a Serial.write(). catStatusRefresh() builds
+  them again when anything the replies, or the frames pushed for auto information, show has
+  changed
+*/
+static uint8_t m_catFreqMode[5];         // 0x03 reply, BCD frequency and mode
+static uint8_t m_catTxStatus;            // 0xF7 reply
+static uint32_t m_catStatusFrequency;
+static bool m_catStatusUSB;
+static bool m_catStatusInTx;
+static bool m_catStatusCw;
+static uint8_t m_catStatusVfo;
+static bool m_catStatusSplit;
+static bool m_catStatusRit;
+static uint32_t m_catStatusRitTx;
+static bool m_catStatusValid = false;
+
+/* receive side, only touched by the receive interrupt while it is running */
+static uint8_t m_catRx[M_CAT_FRAME_SIZE];  // the frame being received
+static uint8_t m_catLength = 0;      // bytes of it received so far
+static uint32_t m_catByteTime = 0;   // millis() when the last byte came in
+static uint16_t m_catRxStart = 0;    // millis() of its first byte, low 16 bits
+static bool m_catRxAligned = true;   // frames are known to start where m_catRx does
+static volatile uint8_t m_catProtocol = M_CAT_UNDECIDED;
+
+/* the Kenwood command being received */
+static uint16_t m_kenwoodCode = 0;   // its two letters
+static uint32_t m_kenwoodParam = 0;  // its digits
+static uint8_t m_kenwoodLength = 0;
+static bool m_kenwoodBad = false;    // the parameter wasn't all digits
+static uint16_t m_kenwoodStart = 0;  // millis() of its first byte, low 16 bits
+
+/*
+  single-producer / single-consumer frame queue. The receive interrupt is the only writer of the
+  head and checkCAT() the only writer of the tail. While it is full the interrupt leaves the
+  bytes in the serial buffer, so a burst waits there rather than being thrown away
+*/
+static uint8_t m_catQueue[M_CAT_QUEUE_SIZE][M_CAT_FRAME_SIZE];
+static uint16_t m_catQueueTime[M_CAT_QUEUE_SIZE];  // millis() of each frame's first byte, low 16 bits
+static volatile uint8_t m_catQueueHead = 0;
+static volatile uint8_t m_catQueueTail = 0;
+static volatile bool m_catHold = false;  // a keyboard CW or state set frame is queued, what follows it is for the frame
+static volatile bool m_catFlush = false;  // throw bytes away until the host pauses, they belong to a lost frame
+
+/* receive statistics - the counters stop at their maximum rather than wrap */
+static volatile uint16_t m_catFrames = 0;         // frames queued
+static volatile uint16_t m_catFramesDropped = 0;  // frames lost to a full queue
+static volatile uint16_t m_catBytesSkipped = 0;   // bytes thrown away resynchronising
+static volatile uint8_t m_catQueueDeepest = 0;    // most frames ever waiting at once
+static volatile uint16_t m_catPartialFrames = 0;  // frames cut short by M_CAT_FRAME_GAP
+
+/*
+  timing statistics, kept by checkCAT(). The latency is from the first byte of a frame coming
+  in to the last byte of the reply going into the serial transmit buffer, in ms. The receive
+  interrupt only looks every millisecond, so a frame answered straight away may show as 0
+*/
+static uint16_t m_catLatency[M_CAT_LATENCY_BUCKETS];
+static uint16_t m_catLatencyWorst = 0;
+static uint16_t m_catReentered = 0;  // checkCAT() calls that found frames waiting while a command ran
+
+/* adds to a statistic, stopping at the maximum */
+static inline void catCount (volatile uint16_t * counter, uint8_t n = 1)
+{
+  *counter = (*counter > 0xFFFF - n) ? 0xFFFF : *counter + n;
+}
 
 /* set high nibble */
 static uint8_t setHighNibble (uint8_t b, uint8_t v)
@@ -108,6 +280,49 @@ static void writeFreq (uint32_t freq, uint8_t * cmd)
   cmd[0] = setHighNibble(cmd[0], digits[8]);
 }
 
+/*
+  builds the poll replies again if the radio has changed since they were last built, returns
+  true if it had
+*/
+static bool catStatusRefresh ()
+{
+  if (m_catStatusValid && m_catStatusFrequency == g_frequency && m_catStatusUSB == g_isUSB &&
+      m_catStatusInTx == g_inTx && m_catStatusCw == g_cwMode && m_catStatusVfo == g_vfoActive &&
+      m_catStatusSplit == g_splitOn && m_catStatusRit == g_ritOn && m_catStatusRitTx == g_ritTxFrequency)
+    return false;
+
+  m_catStatusFrequency = g_frequency;
+  m_catStatusUSB = g_isUSB;
+  m_catStatusInTx = g_inTx;
+  m_catStatusCw = g_cwMode;
+  m_catStatusVfo = g_vfoActive;
+  m_catStatusSplit = g_splitOn;
+  m_catStatusRit = g_ritOn;
+  m_catStatusRitTx = g_ritTxFrequency;
+  m_catStatusValid = true;
+
+  writeFreq(g_frequency, m_catFreqMode);  // Put the frequency into the buffer
+
+  if (g_isUSB)
+    m_catFreqMode[4] = M_CAT_MODE_USB;
+  else
+    m_catFreqMode[4] = M_CAT_MODE_LSB;
+
+  boolean isHighSWR = false;
+
+  /*
+    Inverted -> *ptt = ((p->tx_status & 0x80) == 0); <-- souce code in ft817.c (hamlib)
+    the split bit is inverted the same way, 0 = split on, 1 = split off
+  */
+  m_catTxStatus = ((g_inTx ? 0 : 1) << 7) +
+                  ((isHighSWR ? 1 : 0) << 6) +  // hi swr off / on
+                  ((g_splitOn ? 0 : 1) << 5) + // Split on / off
+                  (0 << 4) +  // dummy data
+                  0x08;  // P0 meter data
+
+  return true;
+}
+
 /* This function takes a frequency that is encoded using 4 bytes of BCD
   representation and turns it into an long measured in Hz.
 
@@ -135,380 +350,1477 @@ static uint32_t readFreq (uint8_t * cmd)
     (uint32_t)d0 * 10L;
 }
 
-/* catReadEEPRom */
-static void catReadEEPRom ()
+/*
+  FT-817 EEPROM emulation. A read (0xBB) of address 'a' replies with the bytes at 'a' and
+  'a' + 1, as the real radio does, so the map is one byte per address. Each byte is either a
+  constant or comes from a getter over the radio's state. Addresses not in the map read as 0.
+  see https://www.ka7oei.com/ft817_memmap.html
+*/
+
+/* 0x55, 0 : VFO A/B  0 = VFO-A, 1 = VFO-B, 7 : MEM/VFO Select  0 = Memory, 1 = VFO */
+static uint8_t catEepromVfo ()
 {
-  // for remove warnings
-  uint8_t temp0 = m_cat[0];
-  uint8_t temp1 = m_cat[1];
+  return 0x80 + (g_vfoActive == VFO_B ? 1 : 0);
+}
 
-  m_cat[0] = 0;
-  m_cat[1] = 0;
+/*
+  0x59, band select, 3-0 VFO A and 7-4 VFO B  0000 = 160 M, 0001 = 75 M, 0010 = 40 M,
+  0011 = 30 M, 0100 = 20 M, 0101 = 17 M, 0110 = 15 M, 0111 = 12 M, 1000 = 10 M
+*/
+static const uint16_t m_catBandEdges[] PROGMEM = {  // kHz, the bottom of each band after 160 M
+  3500, 7000, 10100, 14000, 18068, 21000, 24890, 28000
+};
 
-  switch (temp1)
-  {
-    case 0x45:
-      if (temp0 == 0x03)
-      {
-        m_cat[0] = 0x00;
-        m_cat[1] = 0xD0;
-      }
-      break;
+static uint8_t catBand (uint32_t f)
+{
+  uint8_t band = 0;
 
-    case 0x47:
-      if (temp0 == 0x03)
-      {
-        m_cat[0] = 0xDC;
-        m_cat[1] = 0xE0;
-      }
-      break;
+  while (band < sizeof(m_catBandEdges) / sizeof(m_catBandEdges[0]) &&
+         f >= (uint32_t)pgm_read_word(&m_catBandEdges[band]) * 1000)
+    band++;
 
-    case 0x55:
-      // 0 : VFO A/B  0 = VFO-A, 1 = VFO-B
-      // 1 : MTQMB Select  0 = (Not MTQMB), 1 = MTQMB ("Memory Tune Quick Memory Bank")
-      // 2 : QMB Select  0 = (Not QMB), 1 = QMB  ("Quick Memory Bank")
-      // 3 :
-      // 4 : Home Select  0 = (Not HOME), 1 = HOME memory
-      // 5 : Memory/MTUNE select  0 = Memory, 1 = MTUNE
-      // 6 :
-      // 7 : MEM/VFO Select  0 = Memory, 1 = VFO (A or B - see bit 0)
-      m_cat[0] = 0x80 + (g_vfoActive == VFO_B ? 1 : 0);
-      m_cat[1] = 0x00;
-      break;
+  return band;
+}
 
-    case 0x57:
-      // 0 : 1-0  AGC Mode  00 = Auto, 01 = Fast, 10 = Slow, 11 = Off
-      // 2  DSP On/Off  0 = Off, 1 = On  (Display format)
-      // 4  PBT On/Off  0 = Off, 1 = On  (Passband Tuning)
-      // 5  NB On/Off 0 = Off, 1 = On  (Noise Blanker)
-      // 6  Lock On/Off 0 = Off, 1 = On  (Dial Lock)
-      // 7  FST (Fast Tuning) On/Off  0 = Off, 1 = On  (Fast tuning)
+static uint8_t catEepromBand ()
+{
+  uint32_t a = (g_vfoActive == VFO_A ? g_frequency : g_vfoA);
+  uint32_t b = (g_vfoActive == VFO_B ? g_frequency : g_vfoB);
 
-      m_cat[0] = 0xC0;
-      m_cat[1] = 0x40;
-      break;
+  return (catBand(b) << 4) | catBand(a);
+}
 
-    // band select VFO A Band Select  0000 = 160 M, 0001 = 75 M, 0010 = 40 M,
-    // 0011 = 30 M, 0100 = 20 M, 0101 = 17 M, 0110 = 15 M, 0111 = 12 M, 1000 = 10 M,
-    // 1001 = 6 M, 1010 = FM BCB, 1011 = Air, 1100 = 2 M, 1101 = UHF, 1110 = (Phantom)
-    case 0x59:
-      // https://www.ka7oei.com/ft817_memmap.html
-      // CAT_BUFF[0] = 0xC2;
-      // CAT_BUFF[1] = 0x82;
-      break;
+/*
+  0x5E, 3-0 : CW Pitch (300-1000 Hz) (#20)  From 0 to E (HEX) with 0 = 300 Hz and each step representing 50 Hz
+  5-4 :  Lock Mode (#32) 00 = Dial, 01 = Freq, 10 = Panel
+  7-6 :  Op Filter (#38) 00 = Off, 01 = SSB, 10 = CW
+*/
+static uint8_t catEepromCwPitch ()
+{
+  return (g_sideTone - 300) / 50;
+}
 
-    // Beep Volume (0-100) (#13)
-    case 0x5C:
-      m_cat[0] = 0xB2;
-      m_cat[1] = 0x42;
-      break;
+/*
+  0x5F, 4-0  CW Weight (1.:2.5-1:4.5) (#22)  From 0 to 14 (HEX) with 0 = 1:2.5, incrementing in 0.1 weight steps
+  5  420 ARS (#2)  0 = Off, 1 = On
+  6  144 ARS (#1)  0 = Off, 1 = On
+  7  Sql/RF-G (#45)  0 = Off, 1 = On
+*/
+static uint8_t catEepromCwWeight ()
+{
+  return 0x20 | (g_cwDahRatio - CW_DAH_RATIO_MIN);
+}
 
-    case 0x5E:
-      // 3-0 : CW Pitch (300-1000 Hz) (#20)  From 0 to E (HEX) with 0 = 300 Hz and each step representing 50 Hz
-      // 5-4 :  Lock Mode (#32) 00 = Dial, 01 = Freq, 10 = Panel
-      // 7-6 :  Op Filter (#38) 00 = Off, 01 = SSB, 10 = CW
-      // CAT_BUFF[0] = 0x08;
-      m_cat[0] = (g_sideTone - 300) / 50;
-      m_cat[1] = 0x25;
-      break;
+/* 0x60, CW Delay (10-2500 ms) (#17)  From 1 to 250 (decimal) with each step representing 10 ms */
+static uint8_t catEepromCwDelay ()
+{
+  return g_cwDelayTime;
+}
 
-    // Sidetone (Volume) (#44)
-    case 0x61 :
-      m_cat[0] = g_sideTone % 50;
-      m_cat[1] = 0x08;
-      break;
+/*
+  0x62, 5-0  CW Speed (4-60 WPM) (#21) From 0 to 38 (HEX) with 0 = 4 WPM and 38 = 60 WPM (1 WPM steps)
+  7-6  Batt-Chg (6/8/10 Hours (#11)  00 = 6 Hours, 01 = 8 Hours, 10 = 10 Hours
+*/
+static uint8_t catEepromCwSpeed ()
+{
+  return g_cwWpm - 4;
+}
 
-    case  0x5F:
-      // 4-0  CW Weight (1.:2.5-1:4.5) (#22)  From 0 to 14 (HEX) with 0 = 1:2.5, incrementing in 0.1 weight steps
-      // 5  420 ARS (#2)  0 = Off, 1 = On
-      // 6  144 ARS (#1)  0 = Off, 1 = On
-      // 7  Sql/RF-G (#45)  0 = Off, 1 = On
-      m_cat[0] = 0x32;
-      m_cat[1] = 0x08;
-      break;
+/* 0x78 */
+static uint8_t catEepromMode ()
+{
+  return g_isUSB ? 1 << 5 : 0;
+}
 
-    // CW Delay (10-2500 ms) (#17)  From 1 to 250 (decimal) with each step representing 10 ms
-    case 0x60:
-      m_cat[0] = g_cwDelayTime;
-      m_cat[1] = 0x32;
-      break;
+/*
+  0x7A, 0 HF Antenna Select 0 = Front, 1 = Rear
+  1 6 M Antenna Select  0 = Front, 1 = Rear
+  2 FM BCB Antenna Select 0 = Front, 1 = Rear
+  3 Air Antenna Select  0 = Front, 1 = Rear
+  4 2 M Antenna Select  0 = Front, 1 = Rear
+  5 UHF Antenna Select  0 = Front, 1 = Rear
+  6 ? ?
+  7 SPL On/Off  0 = Off, 1 = On
+*/
+static uint8_t catEepromSplit ()
+{
+  return g_splitOn ? 0xFF : 0x7F;
+}
 
-    case 0x62:
-      // 5-0  CW Speed (4-60 WPM) (#21) From 0 to 38 (HEX) with 0 = 4 WPM and 38 = 60 WPM (1 WPM steps)
-      // 7-6  Batt-Chg (6/8/10 Hours (#11)  00 = 6 Hours, 01 = 8 Hours, 10 = 10 Hours
-      // CAT_BUFF[0] = 0x08;
-      m_cat[0] = 1200 / g_cwSpeed - 4;
-      m_cat[1] = 0xB2;
-      break;
+struct CatEepromByte {
+  uint16_t address;
+  uint8_t value;        // used when there is no getter
+  uint8_t (*get) ();
+};
+
+/* sorted by address for catEepromByte() */
+static const CatEepromByte m_catEeprom[] PROGMEM = {
+  {0x0055, 0x00, catEepromVfo},
+  {0x0057, 0xC0, nullptr},            // AGC, DSP, PBT, NB, lock, fast tuning
+  {0x0058, 0x40, nullptr},
+  {0x0059, 0x00, catEepromBand},
+  {0x005C, 0xB2, nullptr},            // Beep Volume (0-100) (#13)
+  {0x005D, 0x42, nullptr},
+  {0x005E, 0x00, catEepromCwPitch},
+  {0x005F, 0x00, catEepromCwWeight},
+  {0x0060, 0x00, catEepromCwDelay},
+  {0x0061, 0x32, nullptr},            // Sidetone (Volume) (#44)
+  {0x0062, 0x00, catEepromCwSpeed},
+  {0x0063, 0xB2, nullptr},            // 6-0 VOX Gain (#51), 7 Disable AM/FM Dial (#4)
+  {0x0067, 0xB2, nullptr},            // SSB Mic (#46)
+  {0x0068, 0xB2, nullptr},
+  {0x0069, 0xB2, nullptr},            // FM Mic (#29)
+  {0x0078, 0x00, catEepromMode},
+  {0x007A, 0x00, catEepromSplit},
+  {0x00B4, 0x4D, nullptr},
+  {0x0346, 0xD0, nullptr},
+  {0x0347, 0xDC, nullptr},
+  {0x0348, 0xE0, nullptr}
+};
+
+/* the byte the emulated EEPROM holds at 'address' */
+static uint8_t catEepromByte (uint16_t address)
+{
+  int8_t low = 0;
+  int8_t high = sizeof(m_catEeprom) / sizeof(m_catEeprom[0]) - 1;
 
-    case 0x63:
-      // 6-0  VOX Gain (#51)  Contains 1-100 (decimal) as displayed
-      // 7  Disable AM/FM Dial (#4) 0 = Enable, 1 = Disable
-      m_cat[0] = 0xB2;
-      m_cat[1] = 0xA5;
-      break;
+  while (low <= high)
+  {
+    int8_t mid = (low + high) / 2;
+    CatEepromByte entry;
 
-    case 0x64:
-      break;
+    memcpy_P(&entry, m_catEeprom + mid, sizeof(CatEepromByte));
 
-    // 6-0  SSB Mic (#46) Contains 0-100 (decimal) as displayed
-    case 0x67:
-      m_cat[0] = 0xB2;
-      m_cat[1] = 0xB2;
-    break;      case 0x69 : //FM Mic (#29)  Contains 0-100 (decimal) as displayed
+    if (entry.address == address)
+      return entry.get ? entry.get() : entry.value;
 
-    case 0x78 :
-      if (g_isUSB)
-        m_cat[0] = M_CAT_MODE_USB;
-      else
-        m_cat[0] = M_CAT_MODE_LSB;
+    if (entry.address < address)
+      low = mid + 1;
+    else
+      high = mid - 1;
+  }
 
-      if (m_cat[0] != 0) m_cat[0] = 1 << 5;
-      break;
+  return 0;
+}
 
-    case 0x79:
-      // 1-0  TX Power (All bands)  00 = High, 01 = L3, 10 = L2, 11 = L1
-      // 3  PRI On/Off  0 = Off, 1 = On
-      // DW On/Off  0 = Off, 1 = On
-      // SCN (Scan) Mode  00 = No scan, 10 = Scan up, 11 = Scan down
-      // ART On/Off  0 = Off, 1 = On
-      m_cat[0] = 0x00;
-      m_cat[1] = 0x00;
-      break;
+/* the M_CAT_DIRTY_* bit of a VFO */
+static uint8_t catDirtyBit (uint8_t vfo)
+{
+  return vfo == VFO_B ? M_CAT_DIRTY_B : M_CAT_DIRTY_A;
+}
 
-    // SPLIT
-    case 0x7A:
-      // 7A  0 HF Antenna Select 0 = Front, 1 = Rear
-      // 7A  1 6 M Antenna Select  0 = Front, 1 = Rear
-      // 7A  2 FM BCB Antenna Select 0 = Front, 1 = Rear
-      // 7A  3 Air Antenna Select  0 = Front, 1 = Rear
-      // 7A  4 2 M Antenna Select  0 = Front, 1 = Rear
-      // 7A  5 UHF Antenna Select  0 = Front, 1 = Rear
-      // 7A  6 ? ?
-      // 7A  7 SPL On/Off  0 = Off, 1 = On
-
-      m_cat[0] = (g_splitOn ? 0xFF : 0x7F);
-      break;
+/*
+  CAT command handlers, one per opcode. 'cmd' is the whole frame, the four parameter bytes
+  and the opcode
+*/
 
-    case 0xB3:
-      m_cat[0] = 0x00;
-      m_cat[1] = 0x4D;
-      break;
-  }
+/* opcodes known but not supported, a plain acknowledgement */
+static void catAck (uint8_t * cmd)
+{
+  Serial.write((uint8_t)0x00);
+}
+
+/* 0x01, set frequency */
+static void catSetFrequency (uint8_t * cmd)
+{
+  uint32_t f = readFreq(cmd);
 
-  // send the data
-  Serial.write(m_cat, 2);
+  Serial.write((uint8_t)0x00);
+  setFrequency(f);
+  m_catDisplayDirty |= catDirtyBit(g_vfoActive);
 }
 
-/* */
-static void processCATCommand2 (uint8_t * cmd)
+/* 0x02 split on, 0x82 split off, neither is acknowledged */
+static void catSplitOn (uint8_t * cmd)
+{
+  g_splitOn = true;
+}
+
+static void catSplitOff (uint8_t * cmd)
+{
+  g_splitOn = false;
+}
+
+/* 0x03, read frequency and mode */
+static void catReadFrequency (uint8_t * cmd)
+{
+  catStatusRefresh();
+  Serial.write(m_catFreqMode, 5);
+}
+
+/* 0x07, set mode */
+static void catSetMode (uint8_t * cmd)
+{
+  if (cmd[0] == M_CAT_MODE_LSB || cmd[0] == 0x03)  // LSB or CW-R
+    g_isUSB = false;
+  else
+    g_isUSB = true;
+
+  Serial.write((uint8_t)0x00);
+  setFrequency(g_frequency);
+}
+
+/* frequency of one of the VFOs, the active one is g_frequency */
+static uint32_t catVfoFrequency (uint8_t vfo)
+{
+  if (vfo == g_vfoActive)
+    return g_frequency;
+
+  return vfo == VFO_A ? g_vfoA : g_vfoB;
+}
+
+/* sets the frequency of one of the VFOs */
+static void catVfoSet (uint8_t vfo, uint32_t f)
 {
-  uint8_t response[5];
-  uint32_t f;
+  if (vfo == g_vfoActive)
+    setFrequency(f);
+  else if (vfo == VFO_A)
+    g_vfoA = f;
+  else
+    g_vfoB = f;
+
+  m_catDisplayDirty |= catDirtyBit(vfo);
+}
 
-  switch (cmd[4])
+/*
+  makes 'vfo' active for a CAT command. RIT is dropped first, so the VFO being left keeps its
+  real frequency. Nothing is drawn or saved here, catDisplayUpdate() repaints later
+*/
+static void catVfoSwitch (uint8_t vfo)
+{
+  if (g_ritOn)
   {
-    /*  case 0x00:
-        response[0]=0;
-        Serial.write(response, 1);
-        break;
-    */
-    case 0x01:
-      // set frequency
-      f = readFreq(cmd);
-      setFrequency(f);
-      displayVFO(g_vfoActive);
-      response[0] = 0;
-      Serial.write(response, 1);
-      // sprintf(g_buffB, "set:%ld", f);
-      // printLine2(g_buffB);
-      break;
+    g_ritOn = false;
+    g_frequency = g_ritTxFrequency;
+  }
 
-    case 0x02:
-      // split on
-      g_splitOn = true;  //1;
-      break;
+  vfoActivate(vfo);
+  m_catDisplayDirty |= M_CAT_DIRTY_BOTH | M_CAT_DIRTY_PANEL;
+}
 
-    case 0x82:
-      // split off
-      g_splitOn = false;  //0;
-      break;
+/* transmit for a CAT PTT on, the caller checks the radio isn't transmitting already */
+static void catTxStart ()
+{
+  g_txCAT = true;
+  startTx(TX_SSB);
+  m_catDisplayDirty = M_CAT_DIRTY_BOTH;  // split swaps the VFOs
+}
 
-    case 0x03:
-      writeFreq(g_frequency, response);  // Put the frequency into the buffer
+/* back to receive for a CAT PTT off */
+static void catTxStop ()
+{
+  if (g_inTx)
+  {
+    stopTx();
+    g_txCAT = false;
+  }
 
-      if (g_isUSB)
-        response[4] = 0x01;  // USB
-      else
-        response[4] = 0x00;  // LSB
-      Serial.write(response, 5);
-      //printLine2("cat:getfreq");
-      break;
+  m_catDisplayDirty = M_CAT_DIRTY_BOTH;
+}
 
-    // set mode
-    case 0x07:
-      if (cmd[0] == 0x00 || cmd[0] == 0x03)
-        g_isUSB = false;
-      else
-        g_isUSB = true;
-
-      response[0] = 0x00;
-      Serial.write(response, 1);
-      setFrequency(g_frequency);
-      // printLine2("cat: mode changed");
-      // updateDisplay();
-      break;
+/* 0x08, PTT on */
+static void catPttOn (uint8_t * cmd)
+{
+  if (g_inTx)
+  {
+    Serial.write((uint8_t)0xf0);
+    return;
+  }
 
-    // PTT On
-    case 0x08:
-      if (!g_inTx)
-      {
-        response[0] = 0;
-        g_txCAT = true;
-        startTx(TX_SSB);
-        displayVFO(g_vfoActive);
-      }
-      else
-        response[0] = 0xf0;
+  Serial.write((uint8_t)0x00);
+  catTxStart();
+}
 
-      Serial.write(response, 1);
-      displayVFO(g_vfoActive);
-      break;
+/* 0x88, PTT off */
+static void catPttOff (uint8_t * cmd)
+{
+  Serial.write((uint8_t)0x00);
+  catTxStop();
+}
 
-    // PTT Off
-    case 0x88:
-      if (g_inTx)
-      {
-        stopTx();
-        g_txCAT = false;
-      }
+/* 0x81, toggle the VFOs */
+static void catToggleVfo (uint8_t * cmd)
+{
+  Serial.write((uint8_t)0x00);
+  catVfoSwitch(g_vfoActive == VFO_A ? VFO_B : VFO_A);
+}
 
-      response[0] = 0;
-      Serial.write(response, 1);
-      displayVFO(g_vfoActive);
-      break;
+/* 0xBB, read FT-817 EEPROM data, cmd[0] and cmd[1] are the address high and low bytes */
+static void catReadEEPRom (uint8_t * cmd)
+{
+  uint16_t address = (cmd[0] << 8) | cmd[1];
+  uint8_t response[2];
 
-    // toggle the VFOs
-    case 0x81:
-      response[0] = 0;
+  response[0] = catEepromByte(address);
+  response[1] = catEepromByte(address + 1);
 
-      if (g_vfoActive == VFO_A)
-        switchVFO(VFO_B);
-      else
-        switchVFO(VFO_A);
+  Serial.write(response, 2);
+}
 
-      Serial.write(response, 1);
-      // updateDisplay();  // <<<---
-      displayVFO(g_vfoActive);
-      break;
+/* 0xE7, get receiver status */
+static void catRxStatus (uint8_t * cmd)
+{
+  Serial.write(M_CAT_RX_STATUS);
+}
 
-    // Read FT-817 EEPROM Data  (for comfirtable)  // <<--- What does 'confirtable' mean?
-    case 0xBB:
-      catReadEEPRom();
-      break;
+/* 0xF7, get transmitter status */
+static void catTxStatus (uint8_t * cmd)
+{
+  catStatusRefresh();
+  Serial.write(m_catTxStatus);
+}
 
-    case 0xe7 :
-      // get receiver status, we have hardcoded this as
-      // as we dont' support ctcss, etc.
-      response[0] = 0x09;
-      Serial.write(response, 1);
-      break;
+/*
+  (not FT-817) read PTT press to startTx() latency, reset it if cmd[0] is 1
+  replies with worst and average in microseconds (4 bytes each) and the press count (2 bytes), LSB first
+*/
+static void catPttLatency (uint8_t * cmd)
+{
+  uint32_t worst;
+  uint32_t average;
+  uint16_t count;
 
-    case 0xf7:
-      {
-        boolean isHighSWR = false;
-        boolean isSplitOn = false;
-
-        /*
-          Inverted -> *ptt = ((p->tx_status & 0x80) == 0); <-- souce code in ft817.c (hamlib)
-        */
-        response[0] = ((g_inTx ? 0 : 1) << 7) +
-                      ((isHighSWR ? 1 : 0) << 6) +  // hi swr off / on
-                      ((isSplitOn ? 1 : 0) << 5) + // Split on / off
-                      (0 << 4) +  // dummy data
-                      0x08;  // P0 meter data
-
-        Serial.write(response, 1);
-      }
-      break;
+  pttLatency(&worst, &average, &count);
 
-    default:
-      // somehow, get this to print the four bytes
-      ultoa(*((uint32_t *)cmd), g_buffC, HEX);  //16);
+  Serial.write((uint8_t *)&worst, 4);
+  Serial.write((uint8_t *)&average, 4);
+  Serial.write((uint8_t *)&count, 2);
 
-      response[0] = 0x00;
-      Serial.write(response[0]);
-  }
+  if (cmd[0] == 0x01)
+    pttLatencyReset();
+}
 
-  m_insideCat = false;
+/*
+  (not FT-817) read the encoder health counters, reset them if cmd[0] is 1
+  replies with rejected transitions and dropped events (2 bytes each), LSB first
+*/
+static void catEncoderStats (uint8_t * cmd)
+{
+  uint16_t stats[2];
+
+  encoderStats(&stats[0], &stats[1], cmd[0] == 0x01);
+  Serial.write((uint8_t *)stats, 4);
 }
 
-/* check for cat commands / data */
-void checkCAT()
+/*
+  (not FT-817) keyboard CW, the bytes that follow are sent as CW until an ESC (0x1B)
+  replies with the free type-ahead space, or 0xF0 if the radio isn't in CW mode
+*/
+static void catKeyboardCw (uint8_t * cmd)
 {
-  uint8_t i;
+  uint8_t response;
 
-  // Check Serial Port Buffer
-  if (Serial.available() == 0)
+  if (g_cwMode)
   {
-    // Set Buffer Clear status
-    m_rxBufferCheckCount = 0;
-    return;
+    response = cwTextFree();
+    m_catText = true;
   }
-  else if (Serial.available() < 5)
+  else
+    response = 0xf0;
+
+  m_catHold = false;  // the receive interrupt takes CAT frames again, unless it is text now
+
+  Serial.write(response);
+}
+
+/*
+  (not FT-817) read the receive queue statistics, reset them if cmd[0] is 1. Replies with frames
+  received, frames dropped because the queue was full and bytes skipped resynchronising (2 bytes
+  each, LSB first), then the deepest the queue has been and the most it can hold (1 byte each)
+*/
+static void catQueueStats (uint8_t * cmd)
+{
+  uint16_t stats[3];
+  uint8_t depth[2];
+
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
   {
-    // First Arrived
-    if (m_rxBufferCheckCount == 0)
-    {
-      m_rxBufferCheckCount = Serial.available();
-      m_rxBufferArriveTime = millis() + M_CAT_RECEIVE_TIMEOUT;  // Set time for timeout
-    }
-    else if (m_rxBufferArriveTime < millis())
+    stats[0] = m_catFrames;
+    stats[1] = m_catFramesDropped;
+    stats[2] = m_catBytesSkipped;
+    depth[0] = m_catQueueDeepest;
+
+    if (cmd[0] == 0x01)
     {
-      // Clear Buffer
-      for (i = 0; i < Serial.available(); i++)
-        m_rxBufferCheckCount = Serial.read();
-      m_rxBufferCheckCount = 0;
+      m_catFrames = 0;
+      m_catFramesDropped = 0;
+      m_catBytesSkipped = 0;
+      m_catQueueDeepest = 0;
     }
-    else if (m_rxBufferCheckCount < Serial.available())
+  }
+
+  depth[1] = M_CAT_QUEUE_SIZE - 1;
+
+  Serial.write((uint8_t *)stats, 6);
+  Serial.write(depth, 2);
+}
+
+/*
+  the whole radio in one frame for M_CAT_CMD_STATE_READ / M_CAT_CMD_STATE_SET. Sent LSB first
+  as laid out here, followed by a checksum byte that makes the bytes of the frame add up to 0
+*/
+struct CatState {
+  uint8_t version;          // M_CAT_STATE_VERSION
+  uint32_t vfoA;            // Hz
+  uint32_t vfoB;
+  uint8_t flags;            // M_CAT_STATE_*
+  uint32_t ritTxFrequency;  // Hz, while RIT is on
+  uint8_t cwWpm;
+  uint16_t sideTone;        // Hz
+  uint8_t keyType;          // 0 straight, 1 iambic A, 2 iambic B
+};
+
+/* the byte that makes the 'length' bytes at 'data' add up to 0 */
+static uint8_t catChecksum (const uint8_t * data, uint8_t length)
+{
+  uint8_t sum = 0;
+
+  while (length-- > 0)
+    sum += *data++;
+
+  return -sum;
+}
+
+/*
+  reads bytes that follow a frame, the receive interrupt leaves them in the serial port.
+  false if the host stops sending for M_CAT_FRAME_GAP ms
+*/
+static bool catReadPayload (uint8_t * data, uint8_t length)
+{
+  uint32_t last = millis();
+
+  while (length > 0)
+  {
+    if (Serial.available() > 0)
     {
-      // Increase buffer count, slow arrive
-      m_rxBufferCheckCount = Serial.available();
-      m_rxBufferArriveTime = millis() + M_CAT_RECEIVE_TIMEOUT;  // Set time for timeout
+      *data++ = Serial.read();
+      length--;
+      last = millis();
     }
-    return;
+    else if (millis() - last > M_CAT_FRAME_GAP)
+      return false;
   }
 
-  // Arrived CAT DATA
-  for (i = 0; i < 5; i++)
-    m_cat[i] = Serial.read();
+  return true;
+}
 
-  // this code is not re-entrant.
-  if (m_insideCat)
+/*
+  (not FT-817) read the radio state in one frame, replies with a CatState and its checksum.
+  A full sync with the FT-817 set takes 0x03, 0xF7, 0xE7 and several 0xBB reads
+*/
+static void catStateRead (uint8_t * cmd)
+{
+  CatState state;
+
+  state.version = M_CAT_STATE_VERSION;
+  state.vfoA = catVfoFrequency(VFO_A);
+  state.vfoB = catVfoFrequency(VFO_B);
+  state.flags = (g_vfoActive == VFO_B ? M_CAT_STATE_VFO_B : 0) |
+                (vfoIsUSB(VFO_A) ? M_CAT_STATE_USB_A : 0) |
+                (vfoIsUSB(VFO_B) ? M_CAT_STATE_USB_B : 0) |
+                (g_splitOn ? M_CAT_STATE_SPLIT : 0) |
+                (g_ritOn ? M_CAT_STATE_RIT : 0) |
+                (g_inTx ? M_CAT_STATE_TX : 0) |
+                (g_cwMode ? M_CAT_STATE_CW : 0);
+  state.ritTxFrequency = g_ritTxFrequency;
+  state.cwWpm = g_cwWpm;
+  state.sideTone = g_sideTone;
+
+  if (!g_iambicKey)
+    state.keyType = 0;
+  else if (g_keyerControl & IAMBICB)
+    state.keyType = 2;
+  else
+    state.keyType = 1;
+
+  Serial.write((uint8_t *)&state, sizeof(state));
+  Serial.write(catChecksum((uint8_t *)&state, sizeof(state)));
+}
+
+/*
+  (not FT-817) set several fields of the radio state at once. cmd[0] is a mask of
+  M_CAT_SET_* and the frame is followed by a CatState and its checksum, the fields not in the
+  mask are ignored. Nothing is changed unless the whole frame is good and the frequencies set
+  are in the 3.5 to 35 MHz the radio starts up with, replies with 0 if it was, or 0xF0 if it
+  wasn't or the radio is transmitting. The changes aren't saved to EEPROM. If the payload
+  stops short the rest of it is thrown away, up to the host's next pause
+*/
+static void catStateSet (uint8_t * cmd)
+{
+  CatState state;
+  uint8_t check;
+  uint8_t mask = cmd[0];
+  bool ok = catReadPayload((uint8_t *)&state, sizeof(state)) && catReadPayload(&check, 1);
+
+  if (!ok)
+  {
+    // the interrupt is held off, so the byte time is safe to set from here
+    m_catByteTime = millis();
+    m_catFlush = true;
+  }
+
+  m_catHold = false;  // the payload is in, the receive interrupt can take frames again
+
+  ok = ok && !g_inTx && check == catChecksum((uint8_t *)&state, sizeof(state)) &&
+       state.version == M_CAT_STATE_VERSION;
+
+  if (ok && (mask & M_CAT_SET_CW_WPM))
+    ok = (state.cwWpm >= CW_WPM_MIN && state.cwWpm <= CW_WPM_MAX);
+
+  if (ok && (mask & M_CAT_SET_SIDETONE))
+    ok = (state.sideTone >= 100 && state.sideTone <= 2000);
+
+  if (ok && (mask & M_CAT_SET_KEY_TYPE))
+    ok = (state.keyType <= 2);
+
+  if (ok && (mask & M_CAT_SET_VFO_A))
+    ok = (state.vfoA >= 3500000UL && state.vfoA <= 35000000UL);
+
+  if (ok && (mask & M_CAT_SET_VFO_B))
+    ok = (state.vfoB >= 3500000UL && state.vfoB <= 35000000UL);
+
+  Serial.write((uint8_t)(ok ? 0x00 : 0xf0));
+
+  if (!ok)
     return;
 
-  m_insideCat = true;
+  if (mask & M_CAT_SET_ACTIVE_VFO)
+    catVfoSwitch(state.flags & M_CAT_STATE_VFO_B ? VFO_B : VFO_A);
 
-  // This routine is enabled to debug the cat protocol
-  /*
-    int16_t catCount = 0;
+  if (mask & M_CAT_SET_MODES)
+  {
+    vfoSetUSB(VFO_A, state.flags & M_CAT_STATE_USB_A);
+    vfoSetUSB(VFO_B, state.flags & M_CAT_STATE_USB_B);
+  }
 
-    catCount++;
+  if (mask & M_CAT_SET_SPLIT)
+    g_splitOn = (state.flags & M_CAT_STATE_SPLIT);
 
-    if (m_cat[4] != 0xf7 && m_cat[4] != 0xbb && m_cat[4] != 0x03){
-      sprintf(g_buffB, "%d %02x %02x%02x%02x%02x", catCount, m_cat[4],m_cat[0], m_cat[1], m_cat[2], m_cat[3]);
-      printLine2(g_buffB);
-    }
-  */
+  if (mask & M_CAT_SET_CW_WPM)
+  {
+    g_cwWpm = state.cwWpm;
 
-  /*
-    if (!g_doingCAT)
-    {
-      g_doingCAT = true;
-      drawTextWithRectFilled("CAT on", 100, 120, 100, 40, G_DISPLAY_ORANGE, G_DISPLAY_BLACK, G_DISPLAY_WHITE);
-    }
-  */
-  processCATCommand2(m_cat);
+    // Farnsworth spacing only slows things down
+    if (g_cwFarnsworth >= g_cwWpm)
+      g_cwFarnsworth = 0;
 
-  m_insideCat = false;
+    cwTimingUpdate();
+  }
+
+  if (mask & M_CAT_SET_SIDETONE)
+  {
+    g_sideTone = state.sideTone;
+    sidetoneTune(g_sideTone);
+  }
+
+  if (mask & M_CAT_SET_KEY_TYPE)
+  {
+    g_iambicKey = (state.keyType != 0);
+
+    if (state.keyType == 2)
+      g_keyerControl |= IAMBICB;
+    else
+      g_keyerControl &= ~IAMBICB;
+  }
+
+  if (mask & M_CAT_SET_VFO_A)
+    catVfoSet(VFO_A, state.vfoA);
+
+  if (mask & M_CAT_SET_VFO_B)
+    catVfoSet(VFO_B, state.vfoB);
+
+  // the sideband and sidetone both move the oscillators
+  setFrequency(g_frequency);
+  m_catDisplayDirty |= M_CAT_DIRTY_BOTH;
+  if (mask & M_CAT_SET_MODES)
+    m_catDisplayDirty |= M_CAT_DIRTY_PANEL;
+}
+
+/*
+  M_CAT_CMD_AUTO_INFO, cmd[0] not 0 turns auto information on. The frame pushed is the opcode
+  followed by the 0x03 reply and the 0xF7 reply, 7 bytes. It only comes between replies, and
+  no poll reply or ack starts with 0xD8, so a host reading one that does has a push in front
+*/
+static void catAutoInfo (uint8_t * cmd)
+{
+  m_catAutoInfo = cmd[0] != 0;
+  m_kenwoodAutoInfo = 0;  // one host at a time
+  m_catPushDue = m_catAutoInfo;  // start the host off with where the radio is now
+
+  Serial.write((uint8_t)0x00);
+}
+
+static void catTiming (uint8_t * cmd);
+
+struct CatCommand {
+  uint8_t opcode;
+  void (*run) (uint8_t * cmd);
+};
+
+/*
+  the FT-817 CAT set and the opcodes added for this radio, sorted by opcode for catCommand().
+  An opcode that isn't here is not a CAT command, the receive interrupt uses this to find
+  where frames start
+*/
+static const CatCommand m_catCommands[] PROGMEM = {
+  {0x00, catAck},                         // lock on
+  {0x01, catSetFrequency},
+  {0x02, catSplitOn},
+  {0x03, catReadFrequency},
+  {0x05, catAck},                         // clarifier on
+  {0x07, catSetMode},
+  {0x08, catPttOn},
+  {0x09, catAck},                         // repeater offset direction
+  {0x0A, catAck},                         // CTCSS / DCS mode
+  {0x0B, catAck},                         // CTCSS tone
+  {0x0C, catAck},                         // DCS code
+  {0x0F, catAck},                         // power on
+  {0x80, catAck},                         // lock off
+  {0x81, catToggleVfo},
+  {0x82, catSplitOff},
+  {0x85, catAck},                         // clarifier off
+  {0x88, catPttOff},
+  {0x8F, catAck},                         // power off
+  {0xBB, catReadEEPRom},
+  {0xBC, catAck},                         // EEPROM write
+  {0xBD, catAck},                         // TX metering
+  {0xBE, catAck},                         // radio reset
+  {M_CAT_CMD_PTT_LATENCY, catPttLatency},
+  {M_CAT_CMD_ENCODER_STATS, catEncoderStats},
+  {M_CAT_CMD_KEYBOARD_CW, catKeyboardCw},
+  {M_CAT_CMD_CAT_STATS, catQueueStats},
+  {M_CAT_CMD_STATE_READ, catStateRead},
+  {M_CAT_CMD_STATE_SET, catStateSet},
+  {M_CAT_CMD_TIMING, catTiming},
+  {M_CAT_CMD_AUTO_INFO, catAutoInfo},
+  {0xE7, catRxStatus},
+  {0xF5, catAck},                         // clarifier frequency
+  {0xF7, catTxStatus},
+  {0xF9, catAck}                          // repeater offset frequency
+};
+
+/* frames run for each m_catCommands entry */
+static uint16_t m_catCommandCount[sizeof(m_catCommands) / sizeof(m_catCommands[0])];
+
+/* the m_catCommands index of 'opcode', M_CAT_UNKNOWN if it isn't a CAT command */
+static uint8_t catCommandIndex (uint8_t opcode)
+{
+  int8_t low = 0;
+  int8_t high = sizeof(m_catCommands) / sizeof(m_catCommands[0]) - 1;
+
+  while (low <= high)
+  {
+    int8_t mid = (low + high) / 2;
+    uint8_t midOpcode = pgm_read_byte(&m_catCommands[mid].opcode);
+
+    if (midOpcode == opcode)
+      return mid;
+
+    if (midOpcode < opcode)
+      low = mid + 1;
+    else
+      high = mid - 1;
+  }
+
+  return M_CAT_UNKNOWN;
+}
+
+/* runs a CAT frame, the receive interrupt only queues frames with a known opcode */
+static void processCATCommand2 (uint8_t * cmd)
+{
+  uint8_t index = catCommandIndex(cmd[4]);
+
+  if (index != M_CAT_UNKNOWN)
+  {
+    void (*run) (uint8_t *) = (void (*) (uint8_t *))pgm_read_word(&m_catCommands[index].run);
+
+    catCount(&m_catCommandCount[index]);
+    run(cmd);
+  }
+
+  m_insideCat = false;
+}
+
+/*
+  Kenwood TS-480 personality. Commands are two letters, an optional parameter of digits and a
+  ';', e.g. "FA;" reads VFO A and "FA00014035000;" sets it. A host can send several in one
+  write, and "IF;" answers most of what it polls for in one reply. Set commands aren't
+  answered, an unknown command is answered with "?;"
+*/
+
+static constexpr uint16_t kenwoodCode (char a, char b)
+{
+  return ((uint16_t)a << 8) | (uint8_t)b;
+}
+
+/* writes 'value' as 'digits' decimal digits, with leading zeros */
+static void kenwoodDigits (char * out, uint32_t value, uint8_t digits)
+{
+  while (digits-- > 0)
+  {
+    out[digits] = '0' + value % 10;
+    value /= 10;
+  }
+}
+
+/* replies with the command's letters, 'value' as 'digits' digits and the ';' */
+static void kenwoodReply (uint16_t code, uint32_t value, uint8_t digits)
+{
+  char reply[M_KENWOOD_MAX_LENGTH];
+
+  reply[0] = code >> 8;
+  reply[1] = code & 0xFF;
+  kenwoodDigits(reply + 2, value, digits);
+  reply[digits + 2] = ';';
+
+  Serial.write((uint8_t *)reply, digits + 3);
+}
+
+/* the mode as the TS-480 numbers it, 1 LSB, 2 USB, 3 CW, 7 CW-R */
+static uint8_t kenwoodModeNumber ()
+{
+  if (g_cwMode)
+    return g_isUSB ? 3 : 7;
+
+  return g_isUSB ? 2 : 1;
+}
+
+/*
+  AI, auto information. With it on (AI1 to AI3) the IF reply is sent by itself whenever the
+  frequency, mode, VFO, split, RIT or TX state changes, so the host doesn't have to poll. See
+  catPush(). A read answers with the setting the host made
+*/
+static void kenwoodAutoInfo (uint32_t param, bool set)
+{
+  if (!set)
+  {
+    kenwoodReply(kenwoodCode('A', 'I'), m_kenwoodAutoInfo, 1);
+    return;
+  }
+
+  if (param > 3)
+  {
+    Serial.write((const uint8_t *)"?;", 2);
+    return;
+  }
+
+  m_kenwoodAutoInfo = param;
+  m_catAutoInfo = false;  // one host at a time
+  m_catPushDue = true;    // start the host off with where the radio is now
+}
+
+/* FA, VFO A frequency in Hz */
+static void kenwoodVfoA (uint32_t param, bool set)
+{
+  if (set)
+    catVfoSet(VFO_A, param);
+  else
+    kenwoodReply(kenwoodCode('F', 'A'), catVfoFrequency(VFO_A), 11);
+}
+
+/* FB, VFO B frequency in Hz */
+static void kenwoodVfoB (uint32_t param, bool set)
+{
+  if (set)
+    catVfoSet(VFO_B, param);
+  else
+    kenwoodReply(kenwoodCode('F', 'B'), catVfoFrequency(VFO_B), 11);
+}
+
+/* FR, the receive VFO, 0 is A and 1 is B */
+static void kenwoodRxVfo (uint32_t param, bool set)
+{
+  if (!set)
+  {
+    kenwoodReply(kenwoodCode('F', 'R'), g_vfoActive == VFO_B ? 1 : 0, 1);
+    return;
+  }
+
+  catVfoSwitch(param == 1 ? VFO_B : VFO_A);
+}
+
+/* FT, the transmit VFO. Transmitting on the VFO we aren't receiving on is split */
+static void kenwoodTxVfo (uint32_t param, bool set)
+{
+  uint8_t rx = (g_vfoActive == VFO_B ? 1 : 0);
+
+  if (!set)
+  {
+    kenwoodReply(kenwoodCode('F', 'T'), g_splitOn ? !rx : rx, 1);
+    return;
+  }
+
+  g_splitOn = (param != rx);
+  m_catDisplayDirty = M_CAT_DIRTY_BOTH;  // the R: and T: labels
+}
+
+/* ID, the radio model, 020 is the TS-480 */
+static void kenwoodId (uint32_t param, bool set)
+{
+  kenwoodReply(kenwoodCode('I', 'D'), 20, 3);
+}
+
+/*
+  IF, the status in one reply : frequency (11), 5 spaces, RIT offset (+/-, 4), RIT on, XIT on,
+  memory bank and channel (3), TX, mode, VFO, scan, split, tone, tone number (2) and a 0
+*/
+static void kenwoodInfo (uint32_t param, bool set)
+{
+  char reply[38];
+  int32_t offset = 0;
+
+  if (g_ritOn)
+    offset = constrain((int32_t)(g_frequency - g_ritTxFrequency), -9999, 9999);
+
+  memset(reply, '0', sizeof(reply));
+  reply[0] = 'I';
+  reply[1] = 'F';
+  kenwoodDigits(reply + 2, g_frequency, 11);
+  memset(reply + 13, ' ', 5);
+  reply[18] = (offset < 0 ? '-' : '+');
+  kenwoodDigits(reply + 19, abs(offset), 4);
+  reply[23] = (g_ritOn ? '1' : '0');
+  reply[28] = (g_inTx ? '1' : '0');
+  reply[29] = '0' + kenwoodModeNumber();
+  reply[30] = (g_vfoActive == VFO_B ? '1' : '0');
+  reply[32] = (g_splitOn ? '1' : '0');
+  reply[37] = ';';
+
+  Serial.write((uint8_t *)reply, sizeof(reply));
+}
+
+/*
+  MD, the mode. Only the sideband is set, 1 (LSB), 7 (CW-R) and 9 (FSK-R) are lower sideband
+  and the rest upper. CW is still switched on and off from the front panel
+*/
+static void kenwoodMode (uint32_t param, bool set)
+{
+  if (!set)
+  {
+    kenwoodReply(kenwoodCode('M', 'D'), kenwoodModeNumber(), 1);
+    return;
+  }
+
+  g_isUSB = !(param == 1 || param == 7 || param == 9);
+  setFrequency(g_frequency);
+  m_catDisplayDirty |= catDirtyBit(g_vfoActive);
+}
+
+/* PS, power status, always on */
+static void kenwoodPower (uint32_t param, bool set)
+{
+  if (!set)
+    kenwoodReply(kenwoodCode('P', 'S'), 1, 1);
+}
+
+/* RX, back to receive */
+static void kenwoodReceive (uint32_t param, bool set)
+{
+  catTxStop();
+}
+
+/* TX, transmit */
+static void kenwoodTransmit (uint32_t param, bool set)
+{
+  if (!g_inTx)
+    catTxStart();
+}
+
+struct KenwoodCommand {
+  uint16_t code;
+  void (*run) (uint32_t param, bool set);
+};
+
+/* sorted by code for kenwoodFind() */
+static const KenwoodCommand m_kenwoodCommands[] PROGMEM = {
+  {kenwoodCode('A', 'I'), kenwoodAutoInfo},
+  {kenwoodCode('F', 'A'), kenwoodVfoA},
+  {kenwoodCode('F', 'B'), kenwoodVfoB},
+  {kenwoodCode('F', 'R'), kenwoodRxVfo},
+  {kenwoodCode('F', 'T'), kenwoodTxVfo},
+  {kenwoodCode('I', 'D'), kenwoodId},
+  {kenwoodCode('I', 'F'), kenwoodInfo},
+  {kenwoodCode('M', 'D'), kenwoodMode},
+  {kenwoodCode('P', 'S'), kenwoodPower},
+  {kenwoodCode('R', 'X'), kenwoodReceive},
+  {kenwoodCode('T', 'X'), kenwoodTransmit}
+};
+
+/* commands run for each m_kenwoodCommands entry */
+static uint16_t m_kenwoodCount[sizeof(m_kenwoodCommands) / sizeof(m_kenwoodCommands[0])];
+
+/* the m_kenwoodCommands index of 'code', M_KENWOOD_UNKNOWN if we don't know it */
+static uint8_t kenwoodFind (uint16_t code)
+{
+  int8_t low = 0;
+  int8_t high = sizeof(m_kenwoodCommands) / sizeof(m_kenwoodCommands[0]) - 1;
+
+  while (low <= high)
+  {
+    int8_t mid = (low + high) / 2;
+    uint16_t midCode = pgm_read_word(&m_kenwoodCommands[mid].code);
+
+    if (midCode == code)
+      return mid;
+
+    if (midCode < code)
+      low = mid + 1;
+    else
+      high = mid - 1;
+  }
+
+  return M_KENWOOD_UNKNOWN;
+}
+
+/*
+  auto information, sends the IF reply or the M_CAT_CMD_AUTO_INFO frame when the radio has
+  changed. Changes closer together than M_CAT_PUSH_INTERVAL ms go out as one with the latest
+  state, so a fast spin of the knob doesn't fill the serial port. Nothing is pushed while frames
+  are queued, so a push never comes between a command and its reply
+*/
+static void catPush ()
+{
+  if (!m_catPushDue || (m_kenwoodAutoInfo == 0 && !m_catAutoInfo) || m_catQueueTail != m_catQueueHead)
+    return;
+
+  uint32_t now = millis();
+
+  if (now - m_catPushTime < M_CAT_PUSH_INTERVAL)
+    return;
+
+  m_catPushDue = false;
+  m_catPushTime = now;
+
+  if (m_catAutoInfo)
+  {
+    Serial.write(M_CAT_CMD_AUTO_INFO);
+    Serial.write(m_catFreqMode, sizeof(m_catFreqMode));
+    Serial.write(m_catTxStatus);
+  }
+  else
+    kenwoodInfo(0, false);
+}
+
+/* runs a queued Kenwood command */
+static void kenwoodCommand (uint8_t * frame)
+{
+  uint32_t param;
+
+  if (frame[4] == M_KENWOOD_UNKNOWN)
+  {
+    Serial.write((const uint8_t *)"?;", 2);
+    return;
+  }
+
+  memcpy(&param, frame, 4);
+  catCount(&m_kenwoodCount[frame[4]]);
+
+  void (*run) (uint32_t, bool) = (void (*) (uint32_t, bool))pgm_read_word(&m_kenwoodCommands[frame[4]].run);
+
+  run(param, frame[M_CAT_FRAME_KIND] & M_CAT_KENWOOD_SET);
+}
+
+/*
+  keyboard CW, passes the text waiting in the serial port to the keyer. The XON / XOFF
+  is checked every time so the host is let go as soon as the keyer has made room
+*/
+static void catText ()
+{
+  while (Serial.available() > 0)
+  {
+    uint8_t c = Serial.read();
+
+    if (c == M_TEXT_END)
+    {
+      m_catLength = 0;  // anything after the ESC is the start of a CAT frame
+      m_catRxAligned = true;
+      m_catText = false;
+      break;
+    }
+
+    // a host that ignores XOFF loses the overflow
+    cwTextPut(c);
+  }
+
+  uint8_t room = cwTextFree();
+
+  if (!m_catTextXoff && m_catText && room < M_TEXT_XOFF_FREE)
+  {
+    Serial.write(M_TEXT_XOFF);
+    m_catTextXoff = true;
+  }
+  else if (m_catTextXoff && (room >= M_TEXT_XON_FREE || !m_catText))
+  {
+    Serial.write(M_TEXT_XON);
+    m_catTextXoff = false;
+  }
+}
+
+/*
+  leaves keyboard CW without the ESC, when CW mode is switched off under it. The serial port
+  carries CAT frames again and a host held off with XOFF is let go
+*/
+void catTextStop ()
+{
+  if (!m_catText)
+    return;
+
+  m_catLength = 0;
+  m_catText = false;
+
+  if (m_catTextXoff)
+  {
+    Serial.write(M_TEXT_XON);
+    m_catTextXoff = false;
+  }
+}
+
+/* true for the opcodes of the FT-817 CAT set and the ones added for this radio */
+static bool catOpcodeKnown (uint8_t opcode)
+{
+  return catCommandIndex(opcode) != M_CAT_UNKNOWN;
+}
+
+/* adds a frame's latency to the histogram, 'start' is the millis() of its first byte */
+static void catLatencyRecord (uint16_t start)
+{
+  uint16_t latency = (uint16_t)millis() - start;
+  uint8_t bucket = 0;
+
+  while (bucket < M_CAT_LATENCY_BUCKETS - 1 && latency >= pgm_read_byte(&m_catLatencyBuckets[bucket]))
+    bucket++;
+
+  catCount(&m_catLatency[bucket]);
+
+  if (latency > m_catLatencyWorst)
+    m_catLatencyWorst = latency;
+}
+
+/*
+  (not FT-817) read the CAT timing statistics, reset them if cmd[0] is 1. Replies with the
+  latency histogram (under 1, 2, 5, 10, 20, 50 and 100 ms, then slower), the worst latency (ms),
+  the frames cut short by a gap and the checkCAT() calls that found frames waiting while a
+  command ran, 2 bytes each, LSB first. Then the number of FT-817 opcodes run, 1 byte, and for
+  each the opcode and its count (1 + 2 bytes), then the same for Kenwood commands with the two
+  letters in place of the opcode (2 + 2 bytes). Opcodes that haven't been run are left out
+*/
+static void catTiming (uint8_t * cmd)
+{
+  uint16_t partial;
+  uint8_t used = 0;
+
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+  {
+    partial = m_catPartialFrames;
+
+    if (cmd[0] == 0x01)
+      m_catPartialFrames = 0;
+  }
+
+  Serial.write((uint8_t *)m_catLatency, sizeof(m_catLatency));
+  Serial.write((uint8_t *)&m_catLatencyWorst, 2);
+  Serial.write((uint8_t *)&partial, 2);
+  Serial.write((uint8_t *)&m_catReentered, 2);
+
+  for (uint8_t i = 0; i < sizeof(m_catCommandCount) / sizeof(m_catCommandCount[0]); i++)
+    used += (m_catCommandCount[i] != 0);
+
+  Serial.write(used);
+
+  for (uint8_t i = 0; i < sizeof(m_catCommandCount) / sizeof(m_catCommandCount[0]); i++)
+  {
+    if (m_catCommandCount[i] == 0)
+      continue;
+
+    Serial.write(pgm_read_byte(&m_catCommands[i].opcode));
+    Serial.write((uint8_t *)&m_catCommandCount[i], 2);
+  }
+
+  used = 0;
+
+  for (uint8_t i = 0; i < sizeof(m_kenwoodCount) / sizeof(m_kenwoodCount[0]); i++)
+    used += (m_kenwoodCount[i] != 0);
+
+  Serial.write(used);
+
+  for (uint8_t i = 0; i < sizeof(m_kenwoodCount) / sizeof(m_kenwoodCount[0]); i++)
+  {
+    if (m_kenwoodCount[i] == 0)
+      continue;
+
+    uint16_t code = pgm_read_word(&m_kenwoodCommands[i].code);
+
+    Serial.write(code >> 8);
+    Serial.write(code & 0xFF);
+    Serial.write((uint8_t *)&m_kenwoodCount[i], 2);
+  }
+
+  if (cmd[0] == 0x01)
+  {
+    memset(m_catLatency, 0, sizeof(m_catLatency));
+    memset(m_catCommandCount, 0, sizeof(m_catCommandCount));
+    memset(m_kenwoodCount, 0, sizeof(m_kenwoodCount));
+    m_catLatencyWorst = 0;
+    m_catReentered = 0;
+  }
+}
+
+/* true if the four bytes before the opcode are a BCD frequency, as 0x01 needs */
+static bool catFrequencyValid (const uint8_t * cmd)
+{
+  for (uint8_t i = 0; i < 4; i++)
+  {
+    if (getHighNibble(cmd[i]) > 9 || getLowNibble(cmd[i]) > 9)
+      return false;
+  }
+
+  return true;
+}
+
+/* true if there is no room in the queue for another frame */
+static inline bool catQueueFull ()
+{
+  return ((m_catQueueHead + 1) & M_CAT_QUEUE_MASK) == m_catQueueTail;
+}
+
+/*
+  queues a received frame for checkCAT(), 'start' is the millis() of its first byte. False if
+  the queue is full
+*/
+static bool catQueuePush (const uint8_t * frame, uint16_t start)
+{
+  uint8_t head = m_catQueueHead;
+  uint8_t next = (head + 1) & M_CAT_QUEUE_MASK;
+
+  if (next == m_catQueueTail)
+  {
+    catCount(&m_catFramesDropped);
+    return false;
+  }
+
+  memcpy(m_catQueue[head], frame, M_CAT_FRAME_SIZE);
+  m_catQueueTime[head] = start;
+  m_catQueueHead = next;
+  catCount(&m_catFrames);
+
+  uint8_t depth = (next - m_catQueueTail) & M_CAT_QUEUE_MASK;
+
+  if (depth > m_catQueueDeepest)
+    m_catQueueDeepest = depth;
+
+  return true;
+}
+
+/*
+  one byte of an FT-817 frame. A frame is queued as soon as its fifth byte is in. If the fifth
+  byte isn't a known opcode (or a set frequency isn't BCD) the frame is out of step, so the
+  oldest byte is dropped and the next one is tried as the start of a frame. A lost byte costs
+  the frames until the opcode lines up again rather than 500 ms. Lock on (0x00) is only taken
+  where the frames are known to line up, after a gap or a good frame, as a zero byte is common
+  in frequencies and would otherwise hold a shifted stream out of step. Returns true for a
+  whole frame
+*/
+static bool catReceiveFt817 (uint8_t c, bool gap, uint16_t now)
+{
+  if (gap)
+  {
+    if (m_catLength > 0)
+    {
+      catCount(&m_catBytesSkipped, m_catLength);
+      catCount(&m_catPartialFrames);
+      m_catLength = 0;
+    }
+
+    m_catRxAligned = true;
+  }
+
+  if (m_catLength == 0)
+    m_catRxStart = now;
+
+  m_catRx[m_catLength++] = c;
+
+  if (m_catLength < 5)
+    return false;
+
+  if (!catOpcodeKnown(m_catRx[4]) || (m_catRx[4] == 0x00 && !m_catRxAligned) ||
+      (m_catRx[4] == 0x01 && !catFrequencyValid(m_catRx)))
+  {
+    // out of step, slide along a byte
+    memmove(m_catRx, m_catRx + 1, 4);
+    m_catLength = 4;
+    m_catRxAligned = false;
+    catCount(&m_catBytesSkipped);
+    return false;
+  }
+
+  m_catLength = 0;
+  m_catRxAligned = true;
+  m_catRx[M_CAT_FRAME_KIND] = M_CAT_FT817;
+
+  // the bytes after a keyboard CW or state set frame aren't frames, leave them until it has been
+  // run. If the frame itself is lost they are thrown away, up to the host's next pause
+  if (m_catRx[4] == M_CAT_CMD_KEYBOARD_CW || m_catRx[4] == M_CAT_CMD_STATE_SET)
+  {
+    if (catQueuePush(m_catRx, m_catRxStart))
+      m_catHold = true;
+    else
+      m_catFlush = true;
+  }
+  else
+    catQueuePush(m_catRx, m_catRxStart);
+
+  return true;
+}
+
+/*
+  one byte of a Kenwood command, it is queued when the ';' comes in. Returns true for a
+  command we know. While the protocol is undecided anything else is ignored, as it may be
+  FT-817 frames
+*/
+static bool catReceiveKenwood (uint8_t c, bool gap, uint16_t now)
+{
+  bool known = false;
+
+  if (m_kenwoodLength > 0 && gap)
+  {
+    // only a command cut short, not the bytes of FT-817 frames we don't know to be frames yet
+    if (m_catProtocol == M_CAT_KENWOOD)
+      catCount(&m_catPartialFrames);
+
+    m_kenwoodLength = 0;
+  }
+
+  if (c == ';')
+  {
+    if (m_kenwoodLength >= 2 && !m_kenwoodBad)
+    {
+      uint8_t frame[M_CAT_FRAME_SIZE];
+
+      frame[4] = kenwoodFind(m_kenwoodCode);
+      known = (frame[4] != M_KENWOOD_UNKNOWN);
+
+      if (known || m_catProtocol == M_CAT_KENWOOD)
+      {
+        memcpy(frame, &m_kenwoodParam, 4);
+        frame[M_CAT_FRAME_KIND] = M_CAT_KENWOOD | (m_kenwoodLength > 2 ? M_CAT_KENWOOD_SET : 0);
+        catQueuePush(frame, m_kenwoodStart);
+      }
+    }
+
+    m_kenwoodLength = 0;
+    return known;
+  }
+
+  if (m_kenwoodLength == 0)
+  {
+    m_kenwoodStart = now;
+    m_kenwoodCode = 0;
+    m_kenwoodParam = 0;
+    m_kenwoodBad = false;
+  }
+
+  if (m_kenwoodLength < 2)
+  {
+    // not a command, wait for the next ';'
+    if (c < 'A' || c > 'Z')
+    {
+      m_kenwoodBad = true;
+      m_kenwoodLength = 2;
+      return false;
+    }
+
+    m_kenwoodCode = (m_kenwoodCode << 8) | c;
+  }
+  else if (c >= '0' && c <= '9' && m_kenwoodLength < M_KENWOOD_MAX_LENGTH)
+    m_kenwoodParam = m_kenwoodParam * 10 + (c - '0');
+  else
+    m_kenwoodBad = true;
+
+  if (m_kenwoodLength < M_KENWOOD_MAX_LENGTH)
+    m_kenwoodLength++;
+
+  return false;
+}
+
+/*
+  CAT receive. Runs on the Timer0 compare B interrupt, about once a millisecond, so the 64 byte
+  serial buffer (17 ms at 38400 baud) is emptied however long loop() is busy with the screen.
+  At the start of a session each byte goes to both parsers, the first to find a whole command
+  decides the protocol. No FT-817 opcode is a printable character, so Kenwood text never makes
+  an FT-817 frame, and the protocol is locked so FT-817 data bytes can't make a Kenwood command
+*/
+ISR (TIMER0_COMPB_vect)
+{
+  // keyboard CW text is read by checkCAT()
+  if (m_catText || m_catHold)
+    return;
+
+  while (Serial.available() > 0)
+  {
+    uint32_t now = millis();
+
+    // the byte may finish a frame, leave it until checkCAT() has made room. The host hasn't
+    // paused, so the wait mustn't look like a gap
+    if (catQueueFull())
+    {
+      m_catByteTime = now;
+      return;
+    }
+
+    uint8_t c = Serial.read();
+    bool gap = (now - m_catByteTime > M_CAT_FRAME_GAP);
+
+    if (now - m_catByteTime > M_CAT_SESSION_GAP)
+      m_catProtocol = M_CAT_UNDECIDED;
+
+    m_catByteTime = now;
+
+    if (m_catFlush && !gap)
+    {
+      catCount(&m_catBytesSkipped);
+      continue;
+    }
+
+    m_catFlush = false;
+
+    if (m_catProtocol != M_CAT_KENWOOD && catReceiveFt817(c, gap, (uint16_t)now))
+      m_catProtocol = M_CAT_FT817;
+
+    if (m_catProtocol != M_CAT_FT817 && catReceiveKenwood(c, gap, (uint16_t)now))
+      m_catProtocol = M_CAT_KENWOOD;
+
+    if (m_catHold)
+      return;
+  }
+}
+
+/*
+  starts the CAT receive interrupt. Timer0 is already running for millis(), so this only
+  enables its spare compare B interrupt
+*/
+void catSetup ()
+{
+  OCR0B = 0x80;  // half way round, away from the millis() overflow interrupt
+  TIFR0 = _BV(OCF0B);
+  TIMSK0 |= _BV(OCIE0B);
+}
+
+/*
+  true if the frame at the tail of the queue is made stale by the one after it. Only a set
+  command followed straight away by another of the same is dropped, so the commands around
+  it still see the radio as the host left it. For FT-817 that is set frequency or set mode
+*/
+static bool catFrameSuperseded (uint8_t tail)
+{
+  uint8_t next = (tail + 1) & M_CAT_QUEUE_MASK;
+  uint8_t opcode = m_catQueue[tail][4];
+  uint8_t kind = m_catQueue[tail][M_CAT_FRAME_KIND];
+
+  if (next == m_catQueueHead || m_catQueue[next][4] != opcode || m_catQueue[next][M_CAT_FRAME_KIND] != kind)
+    return false;
+
+  if (kind == M_CAT_FT817)
+    return opcode == 0x01 || opcode == 0x07;
+
+  return (kind & M_CAT_KENWOOD_SET) && opcode != M_KENWOOD_UNKNOWN;
+}
+
+/*
+  check for cat commands / data, runs the frames the receive interrupt has queued. While keyboard
+  CW is on, the serial port is read here instead. A set frequency or mode that is about to be
+  replaced is only acknowledged, and the VFO repaint is left to catDisplayUpdate()
+*/
+void checkCAT ()
+{
+  if (m_catText)
+  {
+    catText();
+    return;
+  }
+
+  // this code is not re-entrant, the frames stay queued until the command being run is done
+  if (m_insideCat)
+  {
+    if (m_catQueueTail != m_catQueueHead)
+      catCount(&m_catReentered);
+
+    return;
+  }
+
+  while (m_catQueueTail != m_catQueueHead)
+  {
+    uint8_t tail = m_catQueueTail;
+    uint16_t start = m_catQueueTime[tail];
+
+    if (catFrameSuperseded(tail))
+    {
+      // Kenwood set commands aren't answered
+      if (m_catQueue[tail][M_CAT_FRAME_KIND] == M_CAT_FT817)
+        Serial.write((uint8_t)0x00);
+
+      m_catQueueTail = (tail + 1) & M_CAT_QUEUE_MASK;
+      catLatencyRecord(start);
+      continue;
+    }
+
+    memcpy(m_cat, m_catQueue[tail], M_CAT_FRAME_SIZE);
+    m_catQueueTail = (tail + 1) & M_CAT_QUEUE_MASK;
+
+    m_insideCat = true;
+
+    /*
+      if (!g_doingCAT)
+      {
+        g_doingCAT = true;
+        drawTextWithRectFilled("CAT on", 100, 120, 100, 40, G_DISPLAY_ORANGE, G_DISPLAY_BLACK, G_DISPLAY_WHITE);
+      }
+    */
+    if (m_cat[M_CAT_FRAME_KIND] & M_CAT_KENWOOD)
+      kenwoodCommand(m_cat);
+    else
+      processCATCommand2(m_cat);
+
+    m_insideCat = false;
+    catLatencyRecord(start);
+
+    // the command may have switched to keyboard CW, the rest is text
+    if (m_catText)
+      return;
+  }
+
+  // nothing waiting, get the poll replies ready for the next one and tell a host that asked
+  if (catStatusRefresh())
+    m_catPushDue = true;
+
+  catPush();
+}
+
+/*
+  repaints the VFO display after CAT commands have changed it, at most once every
+  M_CAT_DISPLAY_INTERVAL ms however fast the host sends. Called from loop() only, as
+  checkCAT() is also called from inside the drawing code. The active VFO alone only has its
+  changed digits drawn; once the other one is drawn both are drawn whole, as the display
+  only remembers the digits of one
+*/
+void catDisplayUpdate ()
+{
+  uint32_t now = millis();
+
+  if (m_catDisplayDirty == 0 || now - m_catDisplayTime < M_CAT_DISPLAY_INTERVAL)
+    return;
+
+  uint8_t dirty = m_catDisplayDirty;
+
+  m_catDisplayDirty = 0;
+  m_catDisplayTime = now;
+
+  if (dirty & M_CAT_DIRTY_PANEL)
+    redrawVFOs();  // catVfoSwitch() has already dropped RIT, so this only paints
+  else if (dirty == catDirtyBit(g_vfoActive))
+    displayVFO(g_vfoActive);
+  else
+  {
+    displayVFORedraw(g_vfoActive == VFO_A ? VFO_B : VFO_A);
+    displayVFORedraw(g_vfoActive);
+  }
 }
@@ -26,7 +26,7 @@ struct Button {
 /* file-level constants */
 
 /* main screen buttons */
-static constexpr uint8_t M_MAX_BUTTONS = 17;
+static constexpr uint8_t M_MAX_BUTTONS = 18;
 
 static const struct Button buttons[M_MAX_BUTTONS] PROGMEM = {
   {0, 8, 159, 38, "A"},
@@ -48,7 +48,9 @@ static const struct Button buttons[M_MAX_BUTTONS] PROGMEM = {
   {64, 160, 60, 36, "10"},
   {128, 160, 60, 36, "SPD"},
   {192, 160, 60, 36, "TON"},
-  {256, 160, 60, 36, "FRQ"}
+  {256, 160, 60, 36, "FRQ"},
+
+  {256, 202, 60, 36, "MEM"}  // right hand end of the status bar
 };
 
 /* manual frequency input number-pad buttons */
@@ -74,26 +76,44 @@ static const struct Button m_keypad[M_MAX_NUMPAD_KEYS] PROGMEM = {
   {256, 160, 60, 36, "Can"}
 };
 
+/* decoded CW is written in fixed cells along the command bar, short of the TX indicator */
+static constexpr uint8_t M_DECODE_CELL_WIDTH = 14;
+static constexpr uint8_t M_DECODE_COLUMNS = 19;
+
+/* column of the 1 MHz digit in the VFO text, after the "A:" label and the 10 MHz digit */
+static constexpr uint8_t M_VFO_FIRST_DIGIT = 3;
+
 /* file-level variables */
 static char m_vfoDisplay[12];
+static uint8_t m_vfoCursor = 0;  // column highlighted by the digit cursor in m_vfoDisplay, 0 for none
+static char m_decodeText[M_DECODE_COLUMNS];  // decoded CW on the command bar, oldest first
+static uint8_t m_decodeLength = 0;
+static bool m_decodeShown = false;  // m_decodeText is on the command bar, clearCommandbar() wipes it
 
 static bool m_inTone = false;
 static bool m_inValByKnob = false;
 static bool m_endValByKnob = false;
 
+/* forgets what is on the VFO button, so the next displayVFO() draws every cell and the cursor */
+static void vfoDisplayReset ()
+{
+  memset(m_vfoDisplay, 0, sizeof(m_vfoDisplay));
+  m_vfoCursor = 0;
+}
+
 /* draw one button on the screen and set its attributes */
 static void btnDraw (const Button * btn)
 {
   // vfoA
   if (btn->text[0] == 'A' && btn->text[1] == '\0')  // this approach is faster than strcmp
   {
-    memset(m_vfoDisplay, 0, sizeof(m_vfoDisplay));
+    vfoDisplayReset();
     displayVFO(VFO_A);
   }
   // vfoB
   else if (btn->text[0] == 'B' && btn->text[1] == '\0')  // this approach is faster than strcmp
   {
-    memset(m_vfoDisplay, 0, sizeof(m_vfoDisplay));
+    vfoDisplayReset();
     displayVFO(VFO_B);
   }
   // and the rest... (Gilligan's Island reference omitted)
@@ -162,6 +182,8 @@ static void formatFreq (uint32_t f, char * buffOut)
 static void clearCommandbar ()
 {
   drawRectFilled(0, 48, 320, 30, G_DISPLAY_NEWBACK);
+
+  m_decodeShown = false;
 }
 
 /* draws text in the command area (area below VFOs and above 'standard' buttons) */
@@ -338,6 +360,12 @@ void displayVFO (uint8_t vfo)
   uint8_t cleanWidth = 16;
   uint8_t cleanHeight = 22;
 
+  // column under the digit cursor, skipping the decimal point after the 1 KHz digit
+  uint8_t cursor = 0;
+
+  if (g_tuningRate == TUNING_RATE_DIGIT && vfo == g_vfoActive)
+    cursor = M_VFO_FIRST_DIGIT + g_tuningDigit + (g_tuningDigit > 3 ? 1 : 0);
+
   x = btn.x + 6;
   y = btn.y + 6;
 
@@ -346,14 +374,24 @@ void displayVFO (uint8_t vfo)
   {
     char digit = g_buffC[i];
 
-    if (digit != m_vfoDisplay[i])
+    // redraw changed characters, plus the cells the digit cursor moved from and to
+    if (digit != m_vfoDisplay[i] || (i == cursor) != (i == m_vfoCursor))
     {
+      uint16_t cellColor = G_DISPLAY_BLACK;
+      uint16_t textColor = displayColor;
+
+      if (i == cursor)
+      {
+        cellColor = G_DISPLAY_ORANGE;
+        textColor = G_DISPLAY_BLACK;
+      }
+
       // clean up artifacts from previous character(s)
-      drawRectFilled(x, y, cleanWidth, cleanHeight, G_DISPLAY_BLACK);
+      drawRectFilled(x, y, cleanWidth, cleanHeight, cellColor);
       // checkCAT();
 
       // draw vfo character
-      displayChar(x, y + G_TEXT_LINE_HEIGHT + 3, digit, displayColor, G_DISPLAY_BLACK);
+      displayChar(x, y + G_TEXT_LINE_HEIGHT + 3, digit, textColor, cellColor);
       // checkCAT();  //  <<<--- preoccupation with checking cat!  disabled to speed up drawing
     }
 
@@ -366,16 +404,21 @@ void displayVFO (uint8_t vfo)
   }  // end of the while loop of the characters to be printed
 
   strcpy(m_vfoDisplay, g_buffC);
+  m_vfoCursor = cursor;
 }
 
-/* display both vfos */
-static void displayVFOs ()
+/* display one vfo in full, for when the other one may have been drawn since */
+void displayVFORedraw (uint8_t vfo)
 {
-  memset(m_vfoDisplay, 0, sizeof(m_vfoDisplay));
-  displayVFO(VFO_A);
+  vfoDisplayReset();
+  displayVFO(vfo);
+}
 
-  memset(m_vfoDisplay, 0, sizeof(m_vfoDisplay));
-  displayVFO(VFO_B);
+/* display both vfos, the active one last so the next displayVFO() of it only draws changes */
+static void displayVFOs ()
+{
+  displayVFORedraw(g_vfoActive == VFO_A ? VFO_B : VFO_A);
+  displayVFORedraw(g_vfoActive);
 }
 
 /* displays the RIT TX frequency with horizontal position depending on which VFO is active */
@@ -501,14 +544,13 @@ static void enterFreq ()
 /* shows info at bottom of home screen */
 void drawStatusbar ()
 {
-  // clear status bar area with background colour
-  drawRectFilled(0, 201, 320, 40, G_DISPLAY_NEWBACK);
+  // clear status bar area with background colour, up to the MEM button
+  drawRectFilled(0, 201, 252, 40, G_DISPLAY_NEWBACK);
 
   // i don't like the following info at the bottom of my screen, but feel free to re-enable it
   // ==========================================
   // strcpy(g_buffB, " cw:");
-  // int16_t wpm = 1200 / g_cwSpeed;
-  // itoa(wpm, g_buffC, 10);
+  // itoa(g_cwWpm, g_buffC, 10);
   // strcat(g_buffB, g_buffC);
   // strcat(g_buffB, "wpm, ");
   // itoa(g_sideTone, g_buffC, 10);
@@ -522,13 +564,78 @@ void drawStatusbar ()
   drawRawText(g_customMessage, 0, 215, G_DISPLAY_CYAN, G_DISPLAY_NEWBACK);
 }
 
+/* draws one cell of the decoded CW, over whatever the cell showed before */
+static void drawDecodedCell (uint8_t column)
+{
+  uint16_t x = 10 + column * M_DECODE_CELL_WIDTH;
+
+  drawRectFilled(x, 49, M_DECODE_CELL_WIDTH, 28, G_DISPLAY_NEWBACK);
+  displayChar(x, 53 + G_TEXT_LINE_HEIGHT, m_decodeText[column], G_DISPLAY_WHITE, G_DISPLAY_NEWBACK);
+}
+
+/* puts the decoded CW back on the command bar, e.g. after the TX indicator was cleared away */
+static void drawDecodedText ()
+{
+  if (g_ritOn)
+    return;
+
+  for (uint8_t i = 0; i < m_decodeLength; i++)
+    drawDecodedCell(i);
+
+  m_decodeShown = true;
+}
+
+/*
+  decoded CW. The text is kept, so it can be put back after the command bar was used for
+  something else. Once the line is full it scrolls left a cell for each new character, and
+  only the cells that change are drawn. Nothing is drawn while RIT has the command bar
+*/
+void drawDecodedChar (char c)
+{
+  // no spaces at the start of the line
+  if (c == ' ' && m_decodeLength == 0)
+    return;
+
+  if (g_ritOn)
+    m_decodeShown = false;
+
+  if (m_decodeLength < M_DECODE_COLUMNS)
+  {
+    m_decodeText[m_decodeLength++] = c;
+
+    if (m_decodeShown)
+      drawDecodedCell(m_decodeLength - 1);
+  }
+  else
+  {
+    for (uint8_t i = 0; i < M_DECODE_COLUMNS; i++)
+    {
+      char next = (i + 1 < M_DECODE_COLUMNS) ? m_decodeText[i + 1] : c;
+
+      if (next == m_decodeText[i])
+        continue;
+
+      m_decodeText[i] = next;
+
+      if (m_decodeShown)
+        drawDecodedCell(i);
+    }
+  }
+
+  if (!m_decodeShown)
+    drawDecodedText();
+}
+
 /* show TX indicator when transmitting */
 void drawTx ()
 {
   if (g_inTx)
     drawTextWithRectFilled("TX", 280, 48, 37, 28, G_DISPLAY_BLACK, G_DISPLAY_ORANGE, G_DISPLAY_BLUE);
   else
+  {
     clearCommandbar();
+    drawDecodedText();
+  }
 }
 
 /* (re)draws home screen, optionally clearing the whole screen and/or refreshing vfos */
@@ -615,7 +722,11 @@ void cwToggle (const Button * btn)
   if (!g_cwMode)
     g_cwMode = true;
   else
+  {
     g_cwMode = false;
+    cwMemoryStop();
+    catTextStop();
+  }
 
   setFrequency(g_frequency);
 
@@ -707,7 +818,7 @@ void switchBand (uint32_t bandfreq)
 
   setFrequency(bandfreq + offset);
 
-  memset(m_vfoDisplay, 0, sizeof(m_vfoDisplay));  // set to clear whole vfo button
+  vfoDisplayReset();  // set to clear whole vfo button
 
   displayVFO(g_vfoActive);
 
@@ -722,12 +833,10 @@ void setCwSpeed ()
   // no re-entrance
   if (!m_inValByKnob)
   {
-    wpm = 1200 / g_cwSpeed;
-
     Button btn;
     getButton("SPD", &btn);
 
-    wpm = getValueByKnob(1, 100, 1,  wpm, "CW: ", " WPM", &btn);
+    wpm = getValueByKnob(CW_WPM_MIN, CW_WPM_MAX, 1, g_cwWpm, "CW: ", " WPM", &btn);
   }
   else
   {
@@ -735,10 +844,20 @@ void setCwSpeed ()
     return;
   }
 
-  g_cwSpeed = 1200 / wpm;
+  g_cwWpm = wpm;
 
-  // store new value in eeprom
-  EEPROM.put(CW_SPEED, g_cwSpeed);
+  // Farnsworth spacing only slows things down
+  if (g_cwFarnsworth >= g_cwWpm)
+  {
+    g_cwFarnsworth = 0;
+    EEPROM.put(CW_FARNSWORTH, g_cwFarnsworth);
+  }
+
+  cwTimingUpdate();
+
+  // store new value in eeprom, the dot length too for older firmware
+  EEPROM.put(CW_WPM, g_cwWpm);
+  EEPROM.put(CW_SPEED, (uint16_t)(1200 / wpm));
 
   activeDelay(500);
 }
@@ -790,7 +909,8 @@ void setCwTone ()
 
       oneTime = true;
 
-      tone(PIN_CW_TONE, g_sideTone);
+      sidetoneTune(g_sideTone);
+      sidetoneOn();
 
       itoa(g_sideTone, g_buffC, 10);
       strcpy(g_buffB, "CW Tone: ");
@@ -803,7 +923,7 @@ void setCwTone ()
     }
   }
 
-  noTone(PIN_CW_TONE);
+  sidetoneOff();
 
   // store new value in eeprom
   EEPROM.put(CW_SIDETONE, g_sideTone);
@@ -811,6 +931,78 @@ void setCwTone ()
   clearCommandbar();
 }
 
+/*
+  picks a CW memory with the knob and sends it with the encoder button, a touch cancels. PTT
+  is left alone, in CW mode it is a key. Pressed again while a memory is being sent (or a
+  beacon is waiting to repeat) it stops it
+*/
+void sendCwMemory ()
+{
+  if (cwMemoryBusy())
+  {
+    cwMemoryStop();
+    return;
+  }
+
+  if (!g_cwMode)
+  {
+    drawCommandbar("Select CW first");
+    activeDelay(1000);
+    clearCommandbar();
+    return;
+  }
+
+  uint8_t memory = 0;
+  bool send = false;
+  bool redraw = true;
+
+  while (encoderButtonDown())
+    activeDelay(50);
+
+  while (!readTouch())
+  {
+    if (encoderButtonDown())
+    {
+      send = true;
+      break;
+    }
+
+    int16_t knob = encoderRead();
+
+    if (knob > 0)
+    {
+      memory = (memory + 1) % CW_MEMORIES;
+      redraw = true;
+    }
+    else if (knob < 0)
+    {
+      memory = (memory + CW_MEMORIES - 1) % CW_MEMORIES;
+      redraw = true;
+    }
+
+    if (redraw)
+    {
+      cwMemoryName(memory, g_buffC);
+      strcpy(g_buffB, "CW Mem: ");
+      strcat(g_buffB, g_buffC);
+      drawCommandbar(g_buffB);
+
+      redraw = false;
+    }
+
+    checkCAT();
+  }
+
+  // wait for the button or the touch to be released
+  while (encoderButtonDown() || readTouch())
+    activeDelay(50);
+
+  clearCommandbar();
+
+  if (send)
+    cwMemoryStart(memory);
+}
+
 /* do appropriate action based on the button passed in */
 void doCommand (const Button * btn)
 {
@@ -860,6 +1052,8 @@ void doCommand (const Button * btn)
     setCwSpeed();
   else if (strcmp(btn->text, "TON") == 0)
     setCwTone();
+  else if (strcmp(btn->text, "MEM") == 0)
+    sendCwMemory();
 }
 
 /*
@@ -889,6 +1083,9 @@ void checkTouch ()
     if (btn.x < g_tsPoint.x && g_tsPoint.x < x2 && btn.y < g_tsPoint.y && g_tsPoint.y < y2)
       doCommand(&btn);
   }
+
+  // the paddle isn't for the keyer while a dialog is up
+  cwKeyerCancel();
 }
 
 /* returns true if the encoder button is pressed */
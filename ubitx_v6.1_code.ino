@@ -45,11 +45,18 @@ bool g_ritOn = false;
 bool g_cwMode = false;  // if g_cwMode is on, RX frequency is tuned down by sidetone Hz instead of being zerobeat
 
 /* these are variables that control the keyer behavior */
-uint16_t g_cwSpeed = 100;  // dot period in milliseconds
+uint8_t g_cwWpm = 12;        // character speed in words per minute
+uint8_t g_cwWeight = 50;     // standard weighting
+uint8_t g_cwDahRatio = 30;   // 1:3
+uint8_t g_cwFarnsworth = 0;  // off
+uint8_t g_cwSpaceRatio = 10;  // 1 dit
 uint16_t g_cwDelayTime = 60;
 bool g_iambicKey = true;
 uint8_t g_keyerControl = IAMBICB;
 
+uint8_t g_tuningRate = TUNING_RATE_FIXED;  // fixed 50 Hz steps, one of the velocity curves or the digit cursor
+uint8_t g_tuningDigit = 3;                 // digit cursor starts on the 1 KHz digit
+
 /*
   Raduino needs to keep track of current state of the transceiver. These are a few variables that do it
 */
@@ -61,12 +68,70 @@ bool g_isUSB = false;      // upper sideband was selected, this is reset to the
 bool g_menuOn = false;     // set to 1 when the menu is being displayed, if a menu item sets it to zero, the menu is exited
 uint32_t g_cwTimeout = 0;  // milliseconds to go before the CW transmit line is released and the radio goes back to RX mode
 
+/* file-level constants */
+
+/* tuning step sizes in Hz, from slowest to fastest knob */
+static constexpr uint8_t M_TUNING_STEP_COUNT = 5;
+static const uint16_t m_tuningSteps[M_TUNING_STEP_COUNT] PROGMEM = {10, 50, 100, 500, 2500};
+
+/*
+  velocity curves, one row per TUNING_RATE_xxx setting. Each entry is the detent gap in ms
+  the knob must beat to move up to the next step size, so higher numbers accelerate sooner
+*/
+static const uint16_t m_tuningCurves[TUNING_RATE_FAST][M_TUNING_STEP_COUNT - 1] PROGMEM = {
+  {120, 60, 32, 16},   // gentle
+  {200, 100, 48, 24},  // normal
+  {320, 160, 80, 40}   // fast
+};
+
+/* a detent gap longer than this (ms) is a pause, the curve starts again at the finest step */
+static constexpr uint16_t M_TUNING_PAUSE = 1000;
+
+/* press-and-turn tuning step in Hz */
+static constexpr uint16_t M_COARSE_TUNING_STEP = 1000;
+
+/* encoder button gesture timing, in milliseconds */
+static constexpr uint8_t M_BUTTON_DEBOUNCE = 50;
+static constexpr uint16_t M_BUTTON_DOUBLE_GAP = 300;   // longest gap between the clicks of a double-click
+static constexpr uint16_t M_BUTTON_LONG_PRESS = 2500;  // hold time that opens the setup menu
+
+/* encoder button gestures */
+enum {
+  BUTTON_NONE,
+  BUTTON_CLICK,
+  BUTTON_DOUBLE_CLICK,
+  BUTTON_LONG_PRESS
+};
+
+/* encoder button recognizer states */
+enum {
+  BUTTON_STATE_IDLE,
+  BUTTON_STATE_PRESSED,       // first press, waiting for release or long press
+  BUTTON_STATE_RELEASED,      // first click done, waiting to see if a second press follows
+  BUTTON_STATE_SECOND_PRESS,  // second press of a double-click
+  BUTTON_STATE_TURNED,        // knob turned while pressed, release isn't a click
+  BUTTON_STATE_WAIT_RELEASE   // gesture done, waiting for the button to settle up
+};
+
+/* step size in Hz of each digit under the digit cursor, indexed by g_tuningDigit */
+static const uint32_t m_digitSteps[TUNING_DIGITS] PROGMEM = {1000000l, 100000l, 10000l, 1000l, 100l, 10l};
+
 /* file-level variables */
 static uint32_t m_ritRxFrequency;
 static uint32_t m_firstIF = 45005000L;
 static bool m_isUsbVfoA = false;
 static bool m_isUsbVfoB = true;
 
+static uint16_t m_tuningGap = M_TUNING_PAUSE;  // smoothed time between encoder detents, in milliseconds
+static uint32_t m_tuningLastStep = 0;    // micros() of the last encoder detent seen by tuningStep()
+
+static uint32_t m_pttLatencyWorst = 0;   // PTT press to startTx() latency statistics, in microseconds
+static uint32_t m_pttLatencyTotal = 0;
+static uint16_t m_pttLatencyCount = 0;
+
+static uint8_t m_buttonState = BUTTON_STATE_IDLE;
+static uint32_t m_buttonTime = 0;        // millis() of the last encoder button state change
+
 /*
   Below are the basic functions that control the uBitX. Understand the functions before
   you start hacking around
@@ -322,15 +387,36 @@ void ritDisable ()
   The PTT is checked only if we are not already in a CW transmit session
   If the PTT is pressed, we shift to the RIT base if the RIT was on
   flip the T/R line to T and update the display to denote transmission
+
+  The pin change ISR latches PTT presses with their time, so a press is measured from
+  the moment it happened rather than from when this loop() pass got around to it
 */
 void checkPTT ()
 {
+  uint32_t pressTime;
+  uint8_t edges = pttReadEdges(&pressTime);  // collected even while the CW delay runs, so they don't go stale
+
   // we don't check for PTT when transmitting CW
   if (g_cwTimeout > 0)
     return;
 
   if (digitalRead(PTT) == 0 && !g_inTx)
   {
+    if (edges & PTT_PRESSED)
+    {
+      uint32_t latency = micros() - pressTime;
+
+      if (latency > m_pttLatencyWorst)
+        m_pttLatencyWorst = latency;
+
+      // stop adding once the count would wrap, the average stays valid
+      if (m_pttLatencyCount < 0xFFFF)
+      {
+        m_pttLatencyTotal += latency;
+        m_pttLatencyCount++;
+      }
+    }
+
     startTx(TX_SSB);
 
     activeDelay(50);  // debounce the PTT
@@ -340,51 +426,163 @@ void checkPTT ()
     stopTx();
 }
 
-/* check if the encoder button was pressed */
-void checkButton ()
+/* PTT press to startTx() latency, worst and average in microseconds, and the number of presses measured */
+void pttLatency (uint32_t * worst, uint32_t * average, uint16_t * count)
 {
-  // only if the button is pressed
-  if (!encoderButtonDown())
-    return;
-
-  activeDelay(50);
+  *worst = m_pttLatencyWorst;
+  *average = m_pttLatencyCount ? m_pttLatencyTotal / m_pttLatencyCount : 0;
+  *count = m_pttLatencyCount;
+}
 
-  if (!encoderButtonDown()) // debounce
-    return;
+/* clears the PTT latency statistics */
+void pttLatencyReset ()
+{
+  m_pttLatencyWorst = 0;
+  m_pttLatencyTotal = 0;
+  m_pttLatencyCount = 0;
+}
 
-  // disengage any CAT work (debug only)
-  // doingCAT = false;
+/*
+  true when a click and a double-click do different things. Only the digit cursor tells them
+  apart, everywhere else both open the on-screen buttons
+*/
+static bool buttonDoubleClickUsed ()
+{
+  return g_tuningRate == TUNING_RATE_DIGIT && !g_inTx && !g_ritOn;
+}
 
-  uint16_t downTime = 0;
+/*
+  encoder button gesture recognizer. checkButton() advances it once per loop() pass and never
+  waits, so tuning, touch and CAT keep running while the button is held. When a double-click
+  does something else, a click is only reported once the double-click gap has passed without
+  a second press, otherwise it is reported as soon as the button comes up
+*/
+static uint8_t buttonGesture ()
+{
+  bool down = encoderButtonDown();
+  uint32_t now = millis();
+  uint8_t gesture = BUTTON_NONE;
 
-  // wait about five seconds before showing setup menu
-  while (encoderButtonDown())
+  switch (m_buttonState)
   {
-    activeDelay(10);
+    case BUTTON_STATE_IDLE:
+      if (down)
+      {
+        m_buttonState = BUTTON_STATE_PRESSED;
+        m_buttonTime = now;
+      }
+      break;
 
-    downTime++;
+    case BUTTON_STATE_PRESSED:
+      if (!down)
+      {
+        if (now - m_buttonTime < M_BUTTON_DEBOUNCE)
+          m_buttonState = BUTTON_STATE_IDLE;  // too short, contact bounce
+        else if (!buttonDoubleClickUsed())
+        {
+          // no need to wait for a second press
+          gesture = BUTTON_CLICK;
+          m_buttonState = BUTTON_STATE_WAIT_RELEASE;
+          m_buttonTime = now;
+        }
+        else
+        {
+          m_buttonState = BUTTON_STATE_RELEASED;
+          m_buttonTime = now;
+        }
+      }
+      else if (now - m_buttonTime > M_BUTTON_LONG_PRESS)
+      {
+        gesture = BUTTON_LONG_PRESS;
+        m_buttonState = BUTTON_STATE_WAIT_RELEASE;
+      }
+      break;
 
-    if (downTime > 250) // was 300)
-    {
-      doSetupMenu();
-      return;
-    }
-  }
+    case BUTTON_STATE_RELEASED:
+      if (down && now - m_buttonTime >= M_BUTTON_DEBOUNCE)
+      {
+        m_buttonState = BUTTON_STATE_SECOND_PRESS;
+        m_buttonTime = now;
+      }
+      else if (!down && now - m_buttonTime > M_BUTTON_DOUBLE_GAP)
+      {
+        gesture = BUTTON_CLICK;
+        m_buttonState = BUTTON_STATE_IDLE;
+      }
+      break;
 
-  activeDelay(100);
+    case BUTTON_STATE_SECOND_PRESS:
+      if (!down && now - m_buttonTime >= M_BUTTON_DEBOUNCE)
+      {
+        gesture = BUTTON_DOUBLE_CLICK;
+        m_buttonState = BUTTON_STATE_WAIT_RELEASE;
+      }
+      break;
 
-  doCommands();
+    case BUTTON_STATE_TURNED:
+      // doTuning() keeps coarse tuning until the button comes up
+      if (!down)
+      {
+        m_buttonState = BUTTON_STATE_WAIT_RELEASE;
+        m_buttonTime = now;
+      }
+      break;
 
-  // wait for the button to go up again
-  while (encoderButtonDown())
-    activeDelay(10);
+    case BUTTON_STATE_WAIT_RELEASE:
+      // button must stay up for the debounce time before a new gesture can start
+      if (down)
+        m_buttonTime = now;
+      else if (now - m_buttonTime >= M_BUTTON_DEBOUNCE)
+        m_buttonState = BUTTON_STATE_IDLE;
+      break;
+  }
 
-  activeDelay(50);  // debounce
+  return gesture;
 }
 
+/*
+  check the encoder button and run the action for any finished gesture
 
-/* switch from one vfo to the other, making it active */
-void switchVFO (uint8_t vfoSelect)
+  click - on-screen button selection, or the next digit with the digit cursor
+  double-click - on-screen button selection
+  long press - setup menu
+  press-and-turn - coarse tuning, handled by doTuning()
+*/
+void checkButton ()
+{
+  uint8_t gesture = buttonGesture();
+
+  if (gesture == BUTTON_NONE)
+    return;
+
+  // disengage any CAT work (debug only)
+  // doingCAT = false;
+
+  if (gesture == BUTTON_LONG_PRESS)
+    doSetupMenu();
+  else if (gesture == BUTTON_CLICK && buttonDoubleClickUsed())
+  {
+    // with the digit cursor, a click moves the cursor to the next digit
+    g_tuningDigit = (g_tuningDigit + 1) % TUNING_DIGITS;
+    displayVFO(g_vfoActive);
+    return;
+  }
+  else
+    doCommands();
+
+  // the paddle isn't for the keyer while a menu is up
+  cwKeyerCancel();
+
+  // the menus wait on the button themselves, so just make sure it's up before the next gesture
+  m_buttonState = BUTTON_STATE_WAIT_RELEASE;
+  m_buttonTime = millis();
+}
+
+/*
+  makes 'vfoSelect' the active vfo. The one being left keeps its frequency and sideband and the
+  radio is tuned to the new one, nothing is drawn or saved
+*/
+void vfoActivate (uint8_t vfoSelect)
 {
   if (vfoSelect == VFO_A)
   {
@@ -392,13 +590,6 @@ void switchVFO (uint8_t vfoSelect)
     {
       g_vfoB = g_frequency;
       m_isUsbVfoB = g_isUSB;
-
-      EEPROM.put(VFO_B, g_frequency);
-
-      if (m_isUsbVfoB)
-        EEPROM.put(VFO_B_MODE, VFO_MODE_USB);
-      else
-        EEPROM.put(VFO_B_MODE, VFO_MODE_LSB);
     }
 
     g_vfoActive = VFO_A;
@@ -412,13 +603,6 @@ void switchVFO (uint8_t vfoSelect)
     {
       g_vfoA = g_frequency;
       m_isUsbVfoA = g_isUSB;
-
-      EEPROM.put(VFO_A, g_frequency);
-
-      if (m_isUsbVfoA)
-        EEPROM.put(VFO_A_MODE, VFO_MODE_USB);
-      else
-        EEPROM.put(VFO_A_MODE, VFO_MODE_LSB);
     }
 
     g_vfoActive = VFO_B;
@@ -428,12 +612,71 @@ void switchVFO (uint8_t vfoSelect)
   }
 
   setFrequency(g_frequency);
+}
+
+/* switch from one vfo to the other, making it active */
+void switchVFO (uint8_t vfoSelect)
+{
+  vfoActivate(vfoSelect);
   redrawVFOs();
   saveVFOs();
 }
 
+/* true if a VFO is on upper sideband, the active VFO's sideband is g_isUSB */
+bool vfoIsUSB (uint8_t vfo)
+{
+  if (vfo == g_vfoActive)
+    return g_isUSB;
+
+  return (vfo == VFO_A ? m_isUsbVfoA : m_isUsbVfoB);
+}
+
+/* sets the sideband of a VFO. Call setFrequency() afterwards if it is the active one */
+void vfoSetUSB (uint8_t vfo, bool usb)
+{
+  if (vfo == g_vfoActive)
+    g_isUSB = usb;
+  else if (vfo == VFO_A)
+    m_isUsbVfoA = usb;
+  else
+    m_isUsbVfoB = usb;
+}
+
+/*
+  works out the tuning step size from how fast the knob is turning. The queued encoder
+  events are drained and the time between detents is smoothed, then looked up against the
+  selected velocity curve
+*/
+static uint16_t tuningStep ()
+{
+  EncoderEvent ev;
+
+  while (encoderReadEvent(&ev))
+  {
+    uint32_t gap = (ev.time - m_tuningLastStep) / 1000;
+
+    m_tuningLastStep = ev.time;
+
+    // a pause restarts the curve at the finest step
+    if (gap > M_TUNING_PAUSE)
+      m_tuningGap = M_TUNING_PAUSE;
+    else
+      m_tuningGap = (m_tuningGap * 3 + (uint16_t)gap) / 4;
+  }
+
+  uint8_t i = 0;
+
+  while (i < M_TUNING_STEP_COUNT - 1 && m_tuningGap < pgm_read_word(&m_tuningCurves[g_tuningRate - 1][i]))
+    i++;
+
+  return pgm_read_word(&m_tuningSteps[i]);
+}
+
 /*
-  The tuning jumps by 50 Hz on each step. No acceleration or momentum.
+  With the fixed tuning rate, the tuning jumps by 50 Hz on each step. No acceleration or momentum.
+  With a velocity curve selected, the step grows with knob speed and the new frequency is snapped
+  to that step's grid, so a fast spin is still one setFrequency() call per pass.
+  With the digit cursor, each step changes only the digit under the cursor
 */
 void doTuning ()
 {
@@ -453,6 +696,13 @@ void doTuning ()
 
   s = encoderRead();
 
+  uint16_t step = 50;
+
+  if (g_tuningRate == TUNING_RATE_FIXED || g_tuningRate == TUNING_RATE_DIGIT)
+    encoderFlushEvents();
+  else
+    step = tuningStep();
+
   // encoder is at 0, nothing to see here, move along!
   if (!s)
     return;
@@ -460,11 +710,57 @@ void doTuning ()
   // doingCAT = false;  // go back to manual mode if you were doing CAT (debug only)
   prevFrequency = g_frequency;
 
+  // press-and-turn tunes in coarse steps, and the button release is no longer a click
+  bool coarse = (m_buttonState == BUTTON_STATE_PRESSED || m_buttonState == BUTTON_STATE_TURNED);
+  uint16_t count = abs(s);
+
+  if (coarse)
+  {
+    m_buttonState = BUTTON_STATE_TURNED;
+    step = M_COARSE_TUNING_STEP;
+    count = 1;
+  }
+
   // add or subtract from frequency, depending on encoder value
-  if (s > 0)
-    g_frequency += 50l;
-  else if (s < 0)
-    g_frequency -= 50l;
+  if (!coarse && g_tuningRate == TUNING_RATE_FIXED)
+  {
+    if (s > 0)
+      g_frequency += 50l;
+    else if (s < 0 && g_frequency > 50l)
+      g_frequency -= 50l;
+    else
+      return;
+  }
+  else if (!coarse && g_tuningRate == TUNING_RATE_DIGIT)
+  {
+    uint32_t digitStep = pgm_read_dword(&m_digitSteps[g_tuningDigit]);
+
+    // don't let the digit roll the frequency under zero or past the top of the display
+    if (s > 0 && g_frequency + digitStep < 100000000l)
+      g_frequency += digitStep;
+    else if (s < 0 && g_frequency > digitStep)
+      g_frequency -= digitStep;
+    else
+      return;
+  }
+  else
+  {
+    uint32_t move = (uint32_t)count * step;
+
+    // snap towards the direction of travel so the move never goes backwards
+    if (s > 0)
+      g_frequency = ((g_frequency + move) / step) * step;
+    else if (g_frequency > step)
+    {
+      // stop on the lowest step rather than wrap under zero
+      if (move >= g_frequency)
+        move = g_frequency - 1;
+
+      g_frequency = ((g_frequency - move + step - 1) / step) * step;
+    }
+    else
+      return;
+  }
 
   // set USB or LSB depending on the frequency
   if (prevFrequency < 10000000l && g_frequency >= 10000000l)
@@ -512,8 +808,13 @@ void initSettings ()
   EEPROM.get(VFO_A, g_vfoA);
   EEPROM.get(VFO_B, g_vfoB);
   EEPROM.get(CW_SIDETONE, g_sideTone);
-  EEPROM.get(CW_SPEED, g_cwSpeed);
   EEPROM.get(CW_DELAYTIME, g_cwDelayTime);
+  EEPROM.get(TUNING_RATE, g_tuningRate);
+  EEPROM.get(CW_WPM, g_cwWpm);
+  EEPROM.get(CW_WEIGHT, g_cwWeight);
+  EEPROM.get(CW_DAH_RATIO, g_cwDahRatio);
+  EEPROM.get(CW_FARNSWORTH, g_cwFarnsworth);
+  EEPROM.get(CW_SPACE_RATIO, g_cwSpaceRatio);
 
   if (g_usbCarrier > 11060000l || g_usbCarrier < 11048000l)
     g_usbCarrier = 11052000l;
@@ -523,10 +824,33 @@ void initSettings ()
     g_vfoB = 14000000l;
   if (g_sideTone < 100 || 2000 < g_sideTone)  // set sidetone default of 600 Hz if out of range
     g_sideTone = 600;
-  if (g_cwSpeed < 10 || 1000 < g_cwSpeed)  // set CW dot speed default if out of range
-    g_cwSpeed = 100;
   if (g_cwDelayTime < 10 || g_cwDelayTime > 100)  // set CW delay speed default if out of range
     g_cwDelayTime = 50;
+  if (g_tuningRate > TUNING_RATE_DIGIT)  // keep the fixed 50 Hz steps if out of range
+    g_tuningRate = TUNING_RATE_FIXED;
+  if (g_cwWeight < CW_WEIGHT_MIN || g_cwWeight > CW_WEIGHT_MAX)  // standard weighting if out of range
+    g_cwWeight = 50;
+  if (g_cwDahRatio < CW_DAH_RATIO_MIN || g_cwDahRatio > CW_DAH_RATIO_MAX)  // 1:3 if out of range
+    g_cwDahRatio = 30;
+  if (g_cwSpaceRatio < CW_SPACE_RATIO_MIN || g_cwSpaceRatio > CW_SPACE_RATIO_MAX)  // 1 dit if out of range
+    g_cwSpaceRatio = 10;
+
+  // the first time around the speed is carried over from the dot length older firmware kept in CW_SPEED
+  if (g_cwWpm < CW_WPM_MIN || g_cwWpm > CW_WPM_MAX)
+  {
+    uint16_t dotLength;
+
+    EEPROM.get(CW_SPEED, dotLength);
+
+    if (dotLength < 1200 / CW_WPM_MAX || dotLength > 1200 / CW_WPM_MIN)  // 12 WPM default if out of range
+      dotLength = 100;
+
+    g_cwWpm = (1200 + dotLength / 2) / dotLength;  // nearest
+    EEPROM.put(CW_WPM, g_cwWpm);
+  }
+
+  if (g_cwFarnsworth >= g_cwWpm || g_cwFarnsworth < CW_WPM_MIN)  // Farnsworth off if out of range
+    g_cwFarnsworth = 0;
 
   // the VFO modes are read in as either 2 (USB) or 3(LSB), 0, the default
   // is taken as 'uninitialized'
@@ -637,6 +961,8 @@ void setup ()
   setFrequency(g_vfoA);
 
   encoderSetup();
+  keyerSetup();
+  catSetup();
 
   // do essential calibrations / setup when
   // encoder button is down during power-on
@@ -667,15 +993,26 @@ void setup ()
 */
 void loop ()
 {
+  bool pttWatched = !g_cwMode && !g_txCAT;
+
   if (g_cwMode)
     cwKeyer();
   else if (!g_txCAT)
     checkPTT();
 
+  // checkPTT() doesn't run in CW mode or during a CAT transmission, drop the edges latched
+  // meanwhile so an old press isn't timed when it runs again
+  if (!pttWatched)
+  {
+    uint32_t pressTime;
+
+    pttReadEdges(&pressTime);
+  }
+
   checkButton();
 
-  // tune only when not transmitting
-  if (!g_inTx)
+  // tune only when not transmitting, and don't start a redraw while a latched PTT press waits for checkPTT()
+  if (!g_inTx && !(pttWatched && pttEdgePending()))
   {
     if (g_ritOn)
       doRITTuning();
@@ -686,4 +1023,5 @@ void loop ()
   }
 
   checkCAT();
+  catDisplayUpdate();
 }